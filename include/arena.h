@@ -0,0 +1,47 @@
+// arena.h
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for data that lives for one frame.
+// reset() at the start of each frame rewinds it without freeing, so once the first frames have
+// grown it to the working-set size, later frames never reach the heap. Only for trivially
+// destructible types: nothing is destroyed. One arena per render, so parallel renders do
+// not contend on the global allocator.
+class FrameArena
+{
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t current; // block being carved
+    size_t offset;  // bytes used in the current block
+    size_t used;    // bytes handed out this frame
+    size_t peak;
+
+public:
+    explicit FrameArena(size_t blockSize = 1 << 20);
+    ~FrameArena();
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    void *allocate(size_t bytes, size_t align = 16);
+
+    template <class T>
+    T *alloc(size_t n)
+    {
+        return (T *)allocate(n * sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+    }
+
+    void reset();
+    size_t capacity() const;
+    size_t peak_usage() const { return peak; }
+};
+
+// Number of operator new calls so far. Counted only in builds without NDEBUG,
+// always 0 otherwise.
+size_t heapAllocations();
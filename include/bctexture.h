@@ -0,0 +1,67 @@
+// bctexture.h
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "tgaimage.h"
+#include "imageview.h"
+
+// Texture stored as BC1 (DXT1) blocks: every 4x4 texel block is two RGB565 endpoints plus a
+// 2-bit palette index per texel, 8 bytes in total, i.e. 4 bits per texel instead of 24 or 32.
+// Alpha is dropped. Sampling decodes only the blocks it touches and keeps the last few
+// decoded blocks in a small direct-mapped cache, so a texture must not be sampled from
+// several threads at once.
+class BC1Texture
+{
+private:
+    struct Block
+    {
+        uint16_t c0, c1;
+        uint32_t indices; // texel i of the block (row-major) in bits 2i..2i+1
+    };
+    static const int CACHE_BLOCKS = 64;
+
+    std::vector<Block> blocks;
+    int width;
+    int height;
+    int blocksX;
+    bool flipped; // rows were flipped before encoding, recorded in the cache file
+    uint32_t cache[CACHE_BLOCKS][16];
+    int cacheTags[CACHE_BLOCKS];
+
+    void decodeBlock(const Block &b, uint32_t *out) const;
+
+public:
+    BC1Texture();
+
+    void encode(const ImageView &img);
+    // Fails on a header whose size doesn't match the file
+    bool read(const char *filename);
+    // Removes the file again if it can't be written completely
+    bool write(const char *filename) const;
+
+    // Reads <tgaPath>.bc1 if it is newer than tgaPath and was built with the same flip;
+    // otherwise loads the TGA, optionally flips it, encodes it and writes the cache, reporting
+    // a failed write on std::cerr. The TGA is released before returning. encodedPsnr, if given, receives psnr() against the TGA
+    // when it was encoded, and is left alone when the cache was used.
+    bool load(const char *tgaPath, bool flipVertically, double *encodedPsnr = NULL);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    size_t memory() const { return blocks.size() * sizeof(Block); }
+
+    // Packed BGRA texel, alpha 255; no bounds checking
+    inline uint32_t get(int x, int y)
+    {
+        int bi = (y >> 2) * blocksX + (x >> 2);
+        int slot = bi & (CACHE_BLOCKS - 1);
+        if (cacheTags[slot] != bi)
+        {
+            decodeBlock(blocks[bi], cache[slot]);
+            cacheTags[slot] = bi;
+        }
+        return cache[slot][((y & 3) << 2) | (x & 3)];
+    }
+
+    // Peak signal-to-noise ratio of the decoded RGB against img, in dB
+    double psnr(const ImageView &img);
+};
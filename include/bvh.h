@@ -0,0 +1,53 @@
+// bvh.h
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+// Rays traced together: they share an origin and a maximum distance, and each has its own
+// direction. Directions are stored one component per array, so the AVX2 traversal loads each
+// component of all 8 rays into one register and the other levels test them in a branch-free loop.
+struct RayPacket
+{
+    static const int SIZE = 8;
+    Vec3f origin;
+    float dx[SIZE], dy[SIZE], dz[SIZE];
+    float tmax;
+};
+
+// Bounding volume hierarchy over the triangles of a model, for occlusion queries.
+// The tree is built top-down with the surface area heuristic: at every node the triangle
+// centroids are binned along each axis and the cheapest bin boundary is taken, or a leaf is
+// made when no split beats intersecting every triangle. Both children of a node are stored
+// next to each other, and the leaves' triangles are kept contiguous as a vertex plus two edges.
+class BVH
+{
+public:
+    struct Node
+    {
+        Vec3f lo, hi;
+        int first; // leaf: first triangle; inner node: left child, the right one follows it
+        int count; // triangles in a leaf, 0 for inner nodes
+    };
+    struct Triangle
+    {
+        Vec3f v0, e1, e2;
+    };
+
+private:
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    int depth;
+
+public:
+    BVH();
+    void build(Model &model);
+
+    int node_count() const { return (int)nodes.size(); }
+    int max_depth() const { return depth; }
+
+    // Bit i is set when ray i of the packet hits a triangle at a distance in (0, tmax).
+    // The packet goes down every node at least one of its unblocked rays enters, and a ray
+    // stops at its first hit rather than the nearest one.
+    unsigned occluded(const RayPacket &packet) const;
+};
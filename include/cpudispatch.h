@@ -0,0 +1,58 @@
+// cpudispatch.h
+#pragma once
+
+// Instruction set levels hot kernels are compiled for. GENERIC is whatever the build targets
+// (SSE2 on x86-64); the others are only used on CPUs that report the features.
+enum CpuLevel
+{
+    CPU_GENERIC,
+    CPU_SSE42, // SSE4.2 + POPCNT
+    CPU_AVX2   // AVX2 + FMA + BMI1/2
+};
+
+// Best level this CPU supports, detected once with cpuid. The TINYRENDERER_ISA environment
+// variable (generic, sse4.2 or avx2) lowers it for testing; it cannot raise it above what
+// the CPU reports.
+CpuLevel cpuLevel();
+const char *cpuLevelName(CpuLevel level);
+
+// One line describing the detected and the active level
+const char *cpuDispatchReport();
+
+template <class F>
+F selectKernel(F generic, F sse42, F avx2)
+{
+    switch (cpuLevel())
+    {
+    case CPU_AVX2:
+        return avx2;
+    case CPU_SSE42:
+        return sse42;
+    default:
+        return generic;
+    }
+}
+
+// Per-function ISA targets. The variants are also flattened: everything they call is inlined
+// and so compiled for the same level. Nothing is built for a higher level outside of them,
+// so inline functions from headers can't be emitted with instructions an older CPU lacks.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_DISPATCH_X86 1
+#define KERNEL_SSE42 __attribute__((target("sse4.2,popcnt"), flatten))
+#define KERNEL_AVX2 __attribute__((target("avx2,fma,bmi,bmi2,popcnt"), flatten))
+
+// Defines NAME(PARAMS) to call IMPL(ARGS) compiled for the level selected on first use.
+// PARAMS and ARGS are parenthesized lists. To keep NAME static, declare it static first.
+#define DISPATCH_KERNEL(RET, NAME, IMPL, PARAMS, ARGS)                                        \
+    static RET NAME##_generic PARAMS { return IMPL ARGS; }                                   \
+    KERNEL_SSE42 static RET NAME##_sse42 PARAMS { return IMPL ARGS; }                        \
+    KERNEL_AVX2 static RET NAME##_avx2 PARAMS { return IMPL ARGS; }                          \
+    RET NAME PARAMS                                                                          \
+    {                                                                                        \
+        static RET(*const kernel) PARAMS = selectKernel<RET(*) PARAMS>(NAME##_generic, NAME##_sse42, NAME##_avx2); \
+        return kernel ARGS;                                                                  \
+    }
+#else
+#define DISPATCH_KERNEL(RET, NAME, IMPL, PARAMS, ARGS) \
+    RET NAME PARAMS { return IMPL ARGS; }
+#endif
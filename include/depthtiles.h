@@ -0,0 +1,84 @@
+// depthtiles.h
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+
+// Depth across a float-path triangle as a screen-space plane through t0. rasterizeFloat() and
+// rasterizeFloatDepth() both evaluate it, row() once per row and at() per pixel, so they write
+// bit-identical depths; a PLANE tile stores it and is expanded the same way.
+struct FloatDepthPlane
+{
+    float x0, y0, z0, dzdx, dzdy;
+
+    void setup(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, float area)
+    {
+        x0 = t0.x;
+        y0 = t0.y;
+        z0 = t0.z;
+        float dz1 = t1.z - t0.z, dz2 = t2.z - t0.z;
+        dzdx = (dz2 * (t1.y - t0.y) - dz1 * (t2.y - t0.y)) / area;
+        dzdy = (dz1 * (t2.x - t0.x) - dz2 * (t1.x - t0.x)) / area;
+    }
+    float row(float y) const { return z0 + dzdy * (y - y0); }
+    float at(float rowZ, float x) const { return rowZ + dzdx * (x - x0); }
+};
+
+// Per-tile state of a single-sampled DEPTH_U24 or DEPTH_U16 buffer, in the 8x8 tiles of
+// RenderTarget's TILED layout (whichever layout the rows use). A tile is
+//  - CLEAR: every pixel holds the clear value, and the rows were never written;
+//  - PLANE: one float-path triangle covered all of it and won every pixel, and only that
+//    triangle's depth plane is stored, not the 64 depths;
+//  - ROWS: the rows hold the depth.
+// zmin and zmax bound the encoded depths of the tile in every mode. The rasterizers skip a
+// tile whose zmin a triangle can't reach without reading its rows, store a plane instead of
+// writing rows when a triangle covers a tile entirely above its zmax, and expand a CLEAR or
+// PLANE tile into the rows before testing any pixel of it.
+class DepthTiles
+{
+public:
+    enum Mode
+    {
+        TILE_CLEAR,
+        TILE_PLANE,
+        TILE_ROWS
+    };
+    static const int TILE_SIZE = 8;
+
+    struct Tile
+    {
+        FloatDepthPlane plane; // PLANE only
+        uint32_t zmin, zmax;
+        uint8_t mode;
+        bool dirty; // ROWS written since zmin and zmax were computed; zmin is still a bound
+        bool skip;  // set by the rasterizers for the triangle they are drawing
+    };
+
+private:
+    std::vector<Tile> tiles;
+    int tilesX;
+    int tilesY;
+    uint32_t clearValue;
+    int64_t rejected;
+
+public:
+    DepthTiles();
+
+    // Tiles for a width x height buffer, all ROWS with bounds [0, zmax]; 0 x 0 drops them
+    void resize(int width, int height, uint32_t zmax);
+    bool enabled() const { return !tiles.empty(); }
+    int tiles_x() const { return tilesX; }
+    int tiles_y() const { return tilesY; }
+
+    // Every tile CLEAR with the encoded value; resets the rejection count
+    void clear(uint32_t value);
+    uint32_t clear_value() const { return clearValue; }
+
+    Tile &tile(int tx, int ty) { return tiles[(size_t)ty * tilesX + tx]; }
+    const Tile &tile(int tx, int ty) const { return tiles[(size_t)ty * tilesX + tx]; }
+
+    // Triangle-tile pairs skipped on zmin since the last clear()
+    void count_rejected() { rejected++; }
+    int64_t rejected_count() const { return rejected; }
+    int tile_count(Mode mode) const;
+};
@@ -0,0 +1,35 @@
+// facesort.h
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "rendertarget.h"
+
+// Front-to-back submission order. Faces that face away from the viewer are dropped; the rest
+// are keyed by their nearest vertex's depth, quantized to 16 bits over the frame's depth
+// range, and ordered nearest first by a two-pass LSD radix sort. Drawing in that order lets
+// the depth test reject most hidden fragments before they are shaded. Faces whose keys tie
+// keep their file order.
+class FaceSorter
+{
+private:
+    std::vector<uint16_t> keys, keysTmp;
+    std::vector<int> order, orderTmp;
+    int count;
+
+public:
+    FaceSorter();
+
+    // Buffers keep their size, so sorting the same mesh again allocates nothing
+    void sort(Model &model, const Vec3f *verts, const Vec3f &viewDir);
+
+    const int *faces() const { return order.data(); }
+    int size() const { return count; }
+};
+
+// Fragments a color pass would shade when drawing faces in the given order at the screen
+// positions screen, with the current raster config: the fragments that pass the depth test
+// when they are drawn. scratch is cleared and left holding the depth.
+uint64_t countShadedFragments(Model &model, const Vec3f *screen, const int *faces, int count,
+                              RenderTarget &scratch);
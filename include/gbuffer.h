@@ -0,0 +1,77 @@
+// gbuffer.h
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "rendertarget.h"
+#include "imageview.h"
+#include "lighting.h"
+
+// Surface attributes of the visible fragment of every pixel, so that the model is rasterized
+// once and each lighting variant is a full-screen pass over the buffer. Depth stays in the
+// RenderTarget the buffer is filled through. Besides the interpolated normal, uv and albedo,
+// the face and its barycentric weights are kept for the flat and Gouraud passes, which need
+// the face normal and the per-vertex intensities.
+class GBuffer
+{
+private:
+    int width;
+    int height;
+    std::vector<int> faces; // -1 where nothing was drawn
+    std::vector<Vec3f> barys;
+    std::vector<Vec3f> normals;
+    std::vector<Vec2f> uvs;
+    std::vector<uint32_t> albedos;
+
+public:
+    GBuffer(int w, int h);
+    void clear();
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    size_t memory() const;
+
+    int *face_row(int y) { return &faces[(size_t)y * width]; }
+    Vec3f *bary_row(int y) { return &barys[(size_t)y * width]; }
+    Vec3f *normal_row(int y) { return &normals[(size_t)y * width]; }
+    Vec2f *uv_row(int y) { return &uvs[(size_t)y * width]; }
+    uint32_t *albedo_row(int y) { return &albedos[(size_t)y * width]; }
+    const int *face_row(int y) const { return &faces[(size_t)y * width]; }
+    const Vec3f *bary_row(int y) const { return &barys[(size_t)y * width]; }
+    const Vec3f *normal_row(int y) const { return &normals[(size_t)y * width]; }
+    const Vec2f *uv_row(int y) const { return &uvs[(size_t)y * width]; }
+    const uint32_t *albedo_row(int y) const { return &albedos[(size_t)y * width]; }
+};
+
+// Rasterizes face into target's depth buffer and, wherever it is the nearest so far, records
+// its attributes in gbuffer. The albedo is sampled from texture at the interpolated uv, or is
+// color without a texture. target must be single-sampled and the size of gbuffer.
+void gbufferFace(int face, const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                 const Vec3f &n0, const Vec3f &n1, const Vec3f &n2,
+                 const Vec2f &uv0, const Vec2f &uv1, const Vec2f &uv2,
+                 RenderTarget &target, GBuffer &gbuffer, const ImageView *texture, const TGAColor &color);
+
+// Mesh data the passes look up through the stored face index
+struct RelightMesh
+{
+    const int *faceVerts;       // three vertex indices per face
+    const Vec3f *vertexNormals;
+    const Vec3f *faceNormals;   // unit length
+    const float *occlusion;     // baked ambient visibility per vertex for the Phong pass, or NULL
+};
+
+enum RelightMode
+{
+    RELIGHT_FLAT,
+    RELIGHT_GOURAUD,
+    RELIGHT_PHONG
+};
+
+// Lights rows [y0, y1) of gbuffer and packs them into image, an RGB image of the same size,
+// flipped vertically like RenderTarget::export_tga(image, true). The intensity matches the
+// forward shader of the same mode and scales the stored albedo, or the texel of texture at
+// the stored uv when a texture is given. Disjoint row ranges may be lit concurrently.
+void relightRows(const GBuffer &gbuffer, const RelightMesh &mesh, RelightMode mode,
+                 const Vec3f &lightDir, const PhongParams &params, const ImageView *texture,
+                 int y0, int y1, TGAImage &image);
@@ -0,0 +1,56 @@
+// imageview.h
+#pragma once
+#include <algorithm>
+#include "tgaimage.h"
+
+// Non-owning view of a TGAImage's pixels: an origin pointer plus a signed byte stride between
+// rows. Flipping and cropping only change these, nothing is copied, so a
+// texture stored upside down is sampled through a flipped view instead of being flipped in
+// memory. The view is invalidated if the image is reallocated or destroyed.
+class ImageView
+{
+private:
+    unsigned char *origin; // pixel (0, 0)
+    int width;
+    int height;
+    int bytespp;
+    long rowStride; // bytes from (x, y) to (x, y + 1), negative when flipped vertically
+
+public:
+    ImageView() : origin(NULL), width(0), height(0), bytespp(0), rowStride(0) {}
+    explicit ImageView(TGAImage &img)
+        : origin(img.buffer()), width(img.get_width()), height(img.get_height()), bytespp(img.get_bytespp()),
+          rowStride((long)img.get_width() * img.get_bytespp())
+    {
+    }
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    int get_bytespp() const { return bytespp; }
+    long row_stride() const { return rowStride; }
+
+    ImageView flipped_vertically() const
+    {
+        ImageView v = *this;
+        v.origin = origin + (height - 1) * rowStride;
+        v.rowStride = -rowStride;
+        return v;
+    }
+
+    // w x h sub-rectangle at (x, y), clamped to the view
+    ImageView crop(int x, int y, int w, int h) const
+    {
+        ImageView v = *this;
+        x = std::max(0, std::min(x, width));
+        y = std::max(0, std::min(y, height));
+        v.width = std::max(0, std::min(w, width - x));
+        v.height = std::max(0, std::min(h, height - y));
+        v.origin = origin + y * rowStride + x * bytespp;
+        return v;
+    }
+
+    // Unchecked addressing, callers must stay inside the view. A row's pixels are adjacent.
+    unsigned char *pixel(int x, int y) const { return origin + y * rowStride + x * bytespp; }
+    unsigned char *row(int y) const { return origin + y * rowStride; }
+    TGAColor get(int x, int y) const { return TGAColor(pixel(x, y), bytespp); }
+};
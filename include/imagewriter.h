@@ -0,0 +1,18 @@
+// imagewriter.h
+#pragma once
+#include "rendertarget.h"
+
+// Encoders that read straight from a RenderTarget's buffers, a row at a time, without going
+// through a TGAImage. Multisampled and tiled targets are resolved per row while writing.
+// With flip_vertically the target's row 0 becomes the bottom row of the picture, like
+// RenderTarget::export_tga(image, true) followed by write_tga_file().
+
+// QOI ("Quite OK Image"), lossless, RGB channels
+bool write_qoi(const RenderTarget &target, const char *filename, bool flip_vertically = false);
+
+// Binary PPM (P6), raw 8-bit RGB
+bool write_ppm(const RenderTarget &target, const char *filename, bool flip_vertically = false);
+
+// The depth buffer as a grayscale little-endian PFM (Pf), one float per pixel, nearest sample
+// for multisampled targets. Uncovered pixels keep the clear depth (-FLT_MAX by default).
+bool write_pfm_depth(const RenderTarget &target, const char *filename, bool flip_vertically = false);
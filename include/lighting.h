@@ -0,0 +1,68 @@
+// lighting.h
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "geometry.h"
+
+// Phong lighting model used by phongShading()
+struct PhongParams
+{
+    float ambient;
+    float diffuse;
+    float specular;
+    float shininess;
+    Vec3f viewDir;
+
+    PhongParams() : ambient(0.2f), diffuse(0.7f), specular(0.5f), shininess(10.0f), viewDir(0, 0, -1) {}
+};
+
+// Exact per-pixel Phong intensity in [0, 1]; normal does not have to be unit length
+float phongIntensity(Vec3f normal, const Vec3f &lightDir, const PhongParams &params = PhongParams());
+
+// Phong intensity precomputed for every normal direction, for a fixed light and view.
+// Normals are mapped onto the octahedron |x| + |y| + |z| = 1 and unfolded into a square
+// resolution x resolution table, which is sampled bilinearly. The projection only needs an
+// L1 norm, so a lookup replaces both normalize() calls and the pow() of the exact path.
+// Rebuild whenever the light direction or the Phong parameters change.
+class PhongTable
+{
+private:
+    std::vector<float> table;
+    int resolution;
+    Vec3f lightDir;
+    PhongParams params;
+
+public:
+    PhongTable();
+    void build(const Vec3f &light, int res = 256, const PhongParams &p = PhongParams());
+    int get_resolution() const { return resolution; }
+
+    // normal does not have to be unit length, but must not be zero
+    inline float lookup(const Vec3f &n) const
+    {
+        float s = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        float u = n.x / s, v = n.y / s;
+        if (n.z < 0)
+        {
+            float fu = (1.f - std::fabs(v)) * (u < 0 ? -1.f : 1.f);
+            float fv = (1.f - std::fabs(u)) * (v < 0 ? -1.f : 1.f);
+            u = fu;
+            v = fv;
+        }
+        // Texel centres sit at (i + 0.5) / resolution
+        float fx = (u + 1.f) * 0.5f * resolution - 0.5f;
+        float fy = (v + 1.f) * 0.5f * resolution - 0.5f;
+        fx = std::min(std::max(fx, 0.f), resolution - 1.001f);
+        fy = std::min(std::max(fy, 0.f), resolution - 1.001f);
+        int x = (int)fx, y = (int)fy;
+        float ax = fx - x, ay = fy - y;
+        const float *row = &table[y * resolution + x];
+        float top = row[0] + (row[1] - row[0]) * ax;
+        float bottom = row[resolution] + (row[resolution + 1] - row[resolution]) * ax;
+        return top + (bottom - top) * ay;
+    }
+
+    // Largest and mean absolute difference to phongIntensity() over nsamples random normals
+    void measureError(int nsamples, float &maxError, float &meanError) const;
+};
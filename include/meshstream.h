@@ -0,0 +1,104 @@
+// meshstream.h
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+struct StreamTriangle
+{
+    Vec3f v[3];
+    Vec2f uv[3];
+};
+
+// Fixed-size window over an array of T stored in a file.
+// Elements are read in pages; at most `slots` pages are resident, direct-mapped by page index.
+template <class T>
+class PagedArray
+{
+private:
+    std::ifstream *in;
+    std::streamoff base;
+    uint64_t count;
+    int pageElems;
+    int slots;
+    std::vector<T> pages;
+    std::vector<int64_t> tags; // page held by each slot, -1 if empty
+
+public:
+    uint64_t misses;
+
+    PagedArray() : in(NULL), base(0), count(0), pageElems(1), slots(0), misses(0) {}
+
+    void init(std::ifstream *file, std::streamoff offset, uint64_t n, int elemsPerPage, int nslots)
+    {
+        in = file;
+        base = offset;
+        count = n;
+        pageElems = std::max(1, elemsPerPage);
+        slots = std::max(1, nslots);
+        pages.assign((size_t)pageElems * slots, T());
+        tags.assign(slots, -1);
+        misses = 0;
+    }
+
+    const T &get(uint64_t i)
+    {
+        int64_t page = (int64_t)(i / pageElems);
+        int slot = (int)(page % slots);
+        T *data = &pages[(size_t)slot * pageElems];
+        if (tags[slot] != page)
+        {
+            uint64_t first = (uint64_t)page * pageElems;
+            uint64_t n = std::min<uint64_t>(pageElems, count - first);
+            in->clear();
+            in->seekg(base + (std::streamoff)(first * sizeof(T)));
+            in->read((char *)data, n * sizeof(T));
+            tags[slot] = page;
+            misses++;
+        }
+        return data[i % pageElems];
+    }
+
+    size_t memory() const { return pages.size() * sizeof(T) + tags.size() * sizeof(int64_t); }
+};
+
+// Streams the triangles of an OBJ file in bounded-size chunks, for meshes that do not fit in RAM.
+// The OBJ is converted once into a binary cache next to it (<file>.mesh: vertices, uvs, then
+// triangle indices), which is reused while the OBJ's size and timestamp are unchanged.
+// Triangles are read sequentially in chunks; the vertices and uvs they index are fetched
+// through paged windows, so peak memory stays within the budget whatever the mesh size.
+// Polygons are split into triangle fans; negative (relative) OBJ indices are resolved while
+// converting, and a face with an invalid index fails the conversion.
+class MeshStream
+{
+private:
+    std::ifstream in;
+    std::string cachePath;
+    uint64_t nverts_, nuvs_, nfaces_;
+    uint64_t nextFace;
+    std::streamoff facesOffset;
+    int chunkFaces;
+    std::vector<int32_t> indices; // chunkFaces * (3 vertex + 3 uv) indices
+    PagedArray<Vec3f> verts;
+    PagedArray<Vec2f> uvs;
+
+    bool buildCache(const char *objPath);
+
+public:
+    MeshStream();
+    bool open(const char *objPath, size_t budgetBytes);
+
+    uint64_t nverts() const { return nverts_; }
+    uint64_t nfaces() const { return nfaces_; }
+    int chunk_size() const { return chunkFaces; }
+
+    // Fills chunk with up to chunk_size() triangles, returns how many; 0 once all were read
+    int next(std::vector<StreamTriangle> &chunk);
+
+    // Bytes held by the chunk buffer and the vertex/uv windows
+    size_t memory() const;
+    uint64_t page_misses() const { return verts.misses + uvs.misses; }
+};
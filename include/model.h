@@ -21,8 +21,8 @@ public:
     int nfaces();
     Vec3f vert(int i);
     Vec2f tex_coord(int i);
-    std::vector<int> face(int idx);
-    std::vector<int> tex_face(int idx); // New method to access texture indices
+    const std::vector<int> &face(int idx);
+    const std::vector<int> &tex_face(int idx); // New method to access texture indices
 };
 
 #endif //__MODEL_H__
\ No newline at end of file
@@ -0,0 +1,31 @@
+// occlusion.h
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "bvh.h"
+
+// Per-vertex ambient occlusion, baked offline by ray casting and scaling the ambient term
+// of Phong shading at no per-frame cost. A vertex's value is the fraction of rays, cosine
+// distributed about its normal, that leave the model without hitting a triangle within
+// radius * the model's bounding radius.
+struct OcclusionParams
+{
+    int rays;
+    float radius;
+
+    OcclusionParams() : rays(64), radius(0.5f) {}
+};
+
+// Bakes vertices [first, last) of model into visibility[first, last). bvh must hold the model,
+// and extent is its bounding radius. Each vertex depends only on the mesh, so disjoint ranges
+// can be baked concurrently and the result does not depend on the split.
+void bakeOcclusion(const BVH &bvh, Model &model, const Vec3f *normals, float extent,
+                   const OcclusionParams &params, int first, int last, float *visibility);
+
+// The cache is <model>.ao; it is read only when it is newer than the model and was baked
+// with the same parameters for the same number of vertices. A failed write removes the file.
+bool readOcclusionCache(const char *modelPath, int nverts, const OcclusionParams &params,
+                        std::vector<float> &visibility);
+bool writeOcclusionCache(const char *modelPath, const OcclusionParams &params,
+                         const std::vector<float> &visibility);
@@ -0,0 +1,883 @@
+// rasterizer.h
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include "geometry.h"
+#include "rendertarget.h"
+
+// Coverage modes shared by all shaders.
+// FLOAT is the original path: vertices snapped to whole pixels, coverage from barycentric().
+// FIXED snaps vertices to a 1/2^subpixelBits grid and decides coverage with exact 64-bit
+// edge functions sampled at pixel centres, with a top-left fill rule. Its coverage depends
+// only on the input coordinates, so it is bit-identical regardless of threads or ISA.
+struct RasterConfig
+{
+    enum Mode
+    {
+        FLOAT,
+        FIXED
+    };
+    // Greater z is nearer. GREATER_EQUAL lets a color pass reuse depth laid down by a
+    // depth-only prepass, so only the visible fragment of each pixel gets shaded.
+    enum DepthTest
+    {
+        GREATER,
+        GREATER_EQUAL
+    };
+    Mode mode;
+    int subpixelBits;
+    DepthTest depthTest;
+
+    RasterConfig() : mode(FLOAT), subpixelBits(8), depthTest(GREATER) {}
+};
+
+// Most sub-pixel bits whose edge functions fit in 64 bits on targets up to size pixels on a
+// side: with vertices up to size pixels outside the target, fixed-point coordinates stay below
+// 2^30 and edge function values below 2^63.
+inline int maxSubpixelBits(int size)
+{
+    int log2Size = 0;
+    while ((1 << log2Size) < size)
+        log2Size++;
+    return 29 - log2Size;
+}
+
+void setRasterConfig(const RasterConfig &config);
+const RasterConfig &rasterConfig();
+
+// Barycentric coordinates of P in triangle ABC, (-1, 1, 1) if degenerate.
+// Inline so the per-ISA shading kernels compile it along with the rest of the loop.
+inline Vec3f barycentric(const Vec3f &A, const Vec3f &B, const Vec3f &C, const Vec3f &P)
+{
+    Vec3f s0 = Vec3f(C.x - A.x, B.x - A.x, A.x - P.x);
+    Vec3f s1 = Vec3f(C.y - A.y, B.y - A.y, A.y - P.y);
+    Vec3f u = s0 ^ s1;
+    if (std::fabs(u.z) > 1e-2) // avoid division by zero
+        return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+    return Vec3f(-1, 1, 1); // degenerate triangle
+}
+
+// The denominator of barycentric(), with the same float operations; it rejects triangles
+// where this is within 1e-2 of zero
+inline float barycentricArea(const Vec3f &A, const Vec3f &B, const Vec3f &C)
+{
+    return (C.x - A.x) * (B.y - A.y) - (B.x - A.x) * (C.y - A.y);
+}
+
+// Pixel bounding box of the triangle clipped to the target
+inline void getBoundingBox(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                           int width, int height, int &minX, int &maxX, int &minY, int &maxY)
+{
+    minX = std::max(0, (int)std::min({t0.x, t1.x, t2.x}));
+    maxX = std::min(width - 1, (int)std::max({t0.x, t1.x, t2.x}));
+    minY = std::max(0, (int)std::min({t0.y, t1.y, t2.y}));
+    maxY = std::min(height - 1, (int)std::max({t0.y, t1.y, t2.y}));
+}
+
+// Edge function E(P) = a * P.x + b * P.y + c in fixed point, positive inside
+struct FixedEdge
+{
+    int64_t a, b, c;
+    int64_t bias; // 0 on top-left edges, -1 otherwise so that shared edges are owned once
+
+    void setup(int64_t ax, int64_t ay, int64_t bx, int64_t by)
+    {
+        a = ay - by;
+        b = bx - ax;
+        c = (by - ay) * ax - (bx - ax) * ay;
+    }
+    void flip()
+    {
+        a = -a;
+        b = -b;
+        c = -c;
+    }
+    void setBias() { bias = (a > 0 || (a == 0 && b > 0)) ? 0 : -1; }
+    int64_t at(int64_t x, int64_t y) const { return a * x + b * y + c; }
+};
+
+// Pass as the shader to write depth only: no attribute interpolation, no color writes
+struct DepthOnly
+{
+};
+
+template <class Shader>
+struct IsDepthOnly : std::is_same<typename std::decay<Shader>::type, DepthOnly>
+{
+};
+
+// Shaders that also take the pixel, shade(bc, x, y), get the target coordinates they write to
+template <class Shader>
+inline uint32_t invokeShader(Shader &shade, const Vec3f &bc, int x, int y)
+{
+    if constexpr (std::is_invocable<Shader &, const Vec3f &, int, int>::value)
+        return shade(bc, x, y);
+    else
+        return shade(bc);
+}
+
+template <class T>
+inline bool depthPasses(T stored, T z, bool equal)
+{
+    return equal ? stored <= z : stored < z;
+}
+
+// Depth storage the rasterizers test and write, one per RenderTarget::DepthFormat.
+// Fragments are encoded once and compared in the stored representation.
+struct DepthF32
+{
+    typedef float Value;
+    explicit DepthF32(const RenderTarget &) {}
+    Value encode(float z) const { return z; }
+    static Value *row(RenderTarget &target, int y) { return target.depth_row(y); }
+};
+
+template <class T>
+struct DepthUnorm
+{
+    typedef T Value;
+    float zmin, scale, max;
+    explicit DepthUnorm(const RenderTarget &target)
+        : zmin(target.get_depth_min()), scale(target.get_depth_scale()), max((float)target.get_depth_max())
+    {
+    }
+    // Same arithmetic as RenderTarget::encode_depth(), with the parameters held in registers
+    Value encode(float z) const
+    {
+        float v = (z - zmin) * scale + 1.5f;
+        return v <= 1.f ? (Value)1 : (v >= max ? (Value)max : (Value)v);
+    }
+};
+
+struct DepthU24 : DepthUnorm<uint32_t>
+{
+    explicit DepthU24(const RenderTarget &target) : DepthUnorm<uint32_t>(target) {}
+    static Value *row(RenderTarget &target, int y) { return target.depth_row_u24(y); }
+};
+
+struct DepthU16 : DepthUnorm<uint16_t>
+{
+    explicit DepthU16(const RenderTarget &target) : DepthUnorm<uint16_t>(target) {}
+    static Value *row(RenderTarget &target, int y) { return target.depth_row_u16(y); }
+};
+
+inline int64_t toFixed(float v, int bits)
+{
+    return (int64_t)std::llround((double)v * (double)(1 << bits));
+}
+
+// Standard 2x/4x/8x sample positions relative to the pixel centre, in 1/16 pixel units
+inline const int (*samplePattern(int samples))[2]
+{
+    static const int pattern1[1][2] = {{0, 0}};
+    static const int pattern2[2][2] = {{4, 4}, {-4, -4}};
+    static const int pattern4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+    static const int pattern8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+    switch (samples)
+    {
+    case 2:
+        return pattern2;
+    case 4:
+        return pattern4;
+    case 8:
+        return pattern8;
+    default:
+        return pattern1;
+    }
+}
+
+// Fixed-point triangle setup shared by the single- and multi-sample paths
+struct FixedTriangle
+{
+    FixedEdge e0, e1, e2; // e0 is opposite t0, e1 opposite t1, e2 opposite t2
+    int64_t fminX, fmaxX, fminY, fmaxY;
+    float invArea;
+
+    // Returns false for zero-area triangles
+    bool setup(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, int bits)
+    {
+        int64_t x0 = toFixed(t0.x, bits), y0 = toFixed(t0.y, bits);
+        int64_t x1 = toFixed(t1.x, bits), y1 = toFixed(t1.y, bits);
+        int64_t x2 = toFixed(t2.x, bits), y2 = toFixed(t2.y, bits);
+        e0.setup(x1, y1, x2, y2);
+        e1.setup(x2, y2, x0, y0);
+        e2.setup(x0, y0, x1, y1);
+        int64_t area = e0.at(x0, y0);
+        if (area == 0)
+            return false;
+        if (area < 0)
+        {
+            e0.flip();
+            e1.flip();
+            e2.flip();
+            area = -area;
+        }
+        e0.setBias();
+        e1.setBias();
+        e2.setBias();
+        fminX = std::min({x0, x1, x2});
+        fmaxX = std::max({x0, x1, x2});
+        fminY = std::min({y0, y1, y2});
+        fmaxY = std::max({y0, y1, y2});
+        invArea = 1.f / (float)area;
+        return true;
+    }
+};
+
+// Triangle setup of rasterizeFloat(), rasterizeFloatDepth() and rasterizeFixed(): setup()
+// clips the bounding box and returns false if nothing can be covered. For depth tiles,
+// covers() gives the coverage and depth those compute while stepping at any pixel, maxDepth()
+// bounds the depth of every fragment in a rectangle, rounding included, and exact means that
+// coverage is convex to the pixel, so covering the corners of a rectangle covers all of it.
+struct FloatCoverage
+{
+    Vec3f t0, t1, t2;
+    float area;
+    FloatDepthPlane plane;
+    bool exact;
+    static const bool planar = true;
+
+    bool setup(const Vec3f &a, const Vec3f &b, const Vec3f &c, const RenderTarget &target,
+               int &minX, int &maxX, int &minY, int &maxY)
+    {
+        t0 = a;
+        t1 = b;
+        t2 = c;
+        getBoundingBox(t0, t1, t2, target.get_width(), target.get_height(), minX, maxX, minY, maxY);
+        area = barycentricArea(t0, t1, t2);
+        if (minX > maxX || minY > maxY || !(std::fabs(area) > 1e-2))
+            return false;
+        plane.setup(t0, t1, t2, area);
+        // Whole pixels less than 2^11 apart keep every product in barycentric() an exact integer
+        float extent = std::max({std::fabs(t1.x - t0.x), std::fabs(t1.y - t0.y), std::fabs(t2.x - t0.x),
+                                 std::fabs(t2.y - t0.y), std::fabs(t0.x - minX), std::fabs(t0.x - maxX),
+                                 std::fabs(t0.y - minY), std::fabs(t0.y - maxY)});
+        exact = extent < 2048 && t0.x == std::floor(t0.x) && t0.y == std::floor(t0.y) && t1.x == std::floor(t1.x) &&
+                t1.y == std::floor(t1.y) && t2.x == std::floor(t2.x) && t2.y == std::floor(t2.y);
+        return true;
+    }
+    bool covers(int x, int y, Vec3f &bc, float &z) const
+    {
+        bc = barycentric(t0, t1, t2, Vec3f((float)x, (float)y, 0.f));
+        if (bc.x < 0 || bc.y < 0 || bc.z < 0)
+            return false;
+        z = plane.at(plane.row((float)y), (float)x);
+        return true;
+    }
+    // Nothing in the rectangle is covered; decided only when exact, where barycentric()'s
+    // weights have the signs of its integer edge functions, each greatest at a corner
+    bool misses(int x0, int y0, int x1, int y1) const
+    {
+        if (!exact)
+            return false;
+        const double s = area > 0 ? 1.0 : -1.0;
+        const double ax = t0.x, ay = t0.y, bx = t1.x - ax, by = t1.y - ay, cx = t2.x - ax, cy = t2.y - ay;
+        // ux, uy and area - ux - uy at (x0, y0) and their steps in x and y
+        const double ux = bx * (ay - y0) - (ax - x0) * by, uy = (ax - x0) * cy - cx * (ay - y0);
+        const double f[3][3] = {{ux, by, -bx}, {uy, -cy, cx}, {area - ux - uy, cy - by, bx - cx}};
+        for (int k = 0; k < 3; k++)
+        {
+            double top = s * f[k][0] + std::max(0.0, s * f[k][1] * (x1 - x0)) + std::max(0.0, s * f[k][2] * (y1 - y0));
+            if (top < 0)
+                return true;
+        }
+        return false;
+    }
+    // The tile holds this triangle's plane
+    bool storedIn(const DepthTiles::Tile &tile) const
+    {
+        return tile.mode == DepthTiles::TILE_PLANE && memcmp(&tile.plane, &plane, sizeof(plane)) == 0;
+    }
+    // The plane is linear, so its maximum is at a corner; at() rounds four times at most
+    float maxDepth(int x0, int y0, int x1, int y1) const
+    {
+        double ty0 = (double)plane.dzdy * (y0 - plane.y0), ty1 = (double)plane.dzdy * (y1 - plane.y0);
+        double tx0 = (double)plane.dzdx * (x0 - plane.x0), tx1 = (double)plane.dzdx * (x1 - plane.x0);
+        double error = 4.0 * FLT_EPSILON *
+                       (std::fabs(plane.z0) + std::max(std::fabs(ty0), std::fabs(ty1)) + std::max(std::fabs(tx0), std::fabs(tx1)));
+        return (float)(plane.z0 + std::max(ty0, ty1) + std::max(tx0, tx1) + error);
+    }
+};
+
+// rasterizeFloatDepth()'s coverage test; it agrees with FloatCoverage's wherever that is exact
+struct FloatDepthCoverage : FloatCoverage
+{
+    float s, sarea;
+
+    bool setup(const Vec3f &a, const Vec3f &b, const Vec3f &c, const RenderTarget &target,
+               int &minX, int &maxX, int &minY, int &maxY)
+    {
+        if (!FloatCoverage::setup(a, b, c, target, minX, maxX, minY, maxY))
+            return false;
+        s = area > 0 ? 1.f : -1.f;
+        sarea = std::fabs(area);
+        return true;
+    }
+    bool covers(int x, int y, Vec3f &, float &z) const
+    {
+        const float px = (float)x, py = (float)y;
+        float ux = s * ((t1.x - t0.x) * (t0.y - py) - (t0.x - px) * (t1.y - t0.y));
+        float uy = s * ((t0.x - px) * (t2.y - t0.y) - (t2.x - t0.x) * (t0.y - py));
+        if (ux < 0 || uy < 0 || ux + uy > sarea)
+            return false;
+        z = plane.at(plane.row(py), px);
+        return true;
+    }
+};
+
+struct FixedCoverage
+{
+    FixedTriangle tri;
+    int64_t one, half;
+    float z0, z1, z2;
+    static const bool exact = true;
+    static const bool planar = false;
+
+    bool setup(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, int bits, const RenderTarget &target,
+               int &minX, int &maxX, int &minY, int &maxY)
+    {
+        if (!tri.setup(t0, t1, t2, bits))
+            return false;
+        one = (int64_t)1 << bits;
+        half = one >> 1;
+        z0 = t0.z;
+        z1 = t1.z;
+        z2 = t2.z;
+        minX = (int)std::max<int64_t>(0, (tri.fminX - half + one - 1) >> bits);
+        maxX = (int)std::min<int64_t>(target.get_width() - 1, (tri.fmaxX - half) >> bits);
+        minY = (int)std::max<int64_t>(0, (tri.fminY - half + one - 1) >> bits);
+        maxY = (int)std::min<int64_t>(target.get_height() - 1, (tri.fmaxY - half) >> bits);
+        return minX <= maxX && minY <= maxY;
+    }
+    bool covers(int x, int y, Vec3f &bc, float &z) const
+    {
+        const int64_t px = x * one + half, py = y * one + half;
+        int64_t w0 = tri.e0.at(px, py), w1 = tri.e1.at(px, py), w2 = tri.e2.at(px, py);
+        if ((w0 + tri.e0.bias) < 0 || (w1 + tri.e1.bias) < 0 || (w2 + tri.e2.bias) < 0)
+            return false;
+        bc = Vec3f(w0 * tri.invArea, w1 * tri.invArea, w2 * tri.invArea);
+        z = z0 * bc.x + z1 * bc.y + z2 * bc.z;
+        return true;
+    }
+    bool storedIn(const DepthTiles::Tile &) const { return false; }
+    // Nothing in the rectangle is covered: some edge is negative at all of its corners
+    bool misses(int x0, int y0, int x1, int y1) const
+    {
+        for (const FixedEdge *e : {&tri.e0, &tri.e1, &tri.e2})
+        {
+            int64_t top = e->at(x0 * one + half, y0 * one + half) + std::max<int64_t>(0, e->a * one * (x1 - x0)) +
+                          std::max<int64_t>(0, e->b * one * (y1 - y0)) + e->bias;
+            if (top < 0)
+                return true;
+        }
+        return false;
+    }
+    // Depth interpolated exactly, at the corner where it is greatest; covered pixels have
+    // weights in [0, 1], so the float weights and sum stray by a few roundings of the largest z
+    float maxDepth(int x0, int y0, int x1, int y1) const
+    {
+        const FixedEdge *e[3] = {&tri.e0, &tri.e1, &tri.e2};
+        const double z[3] = {z0, z1, z2};
+        double at = 0, area = 0, dx = 0, dy = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            double w = (double)e[k]->at(x0 * one + half, y0 * one + half);
+            at += z[k] * w;
+            area += w;
+            dx += z[k] * (double)e[k]->a * one;
+            dy += z[k] * (double)e[k]->b * one;
+        }
+        double top = (at + std::max(0.0, dx * (x1 - x0)) + std::max(0.0, dy * (y1 - y0))) / area;
+        double error = 8.0 * FLT_EPSILON * std::max({std::fabs(z[0]), std::fabs(z[1]), std::fabs(z[2])});
+        return (float)(top + error);
+    }
+};
+
+template <class Depth>
+inline DepthTiles *depthTilesOf(RenderTarget &target)
+{
+    if constexpr (std::is_same<Depth, DepthF32>::value)
+        return NULL;
+    else
+        return target.depth_tiles();
+}
+
+// Depth tiles for a triangle with this clipped box, or NULL to draw it straight into the rows.
+// Per-tile decisions cost more than a small triangle could save, so a box under 256 pixels
+// only expands the tiles it touches and marks them dirty.
+template <class Depth>
+inline DepthTiles *tilesForTriangle(RenderTarget &target, int minX, int maxX, int minY, int maxY)
+{
+    DepthTiles *tiles = depthTilesOf<Depth>(target);
+    if (!tiles || (maxX - minX + 1) * (maxY - minY + 1) >= 256)
+        return tiles;
+    const int T = DepthTiles::TILE_SIZE;
+    for (int ty = minY / T; ty <= maxY / T; ty++)
+    {
+        for (int tx = minX / T; tx <= maxX / T; tx++)
+        {
+            DepthTiles::Tile &tile = tiles->tile(tx, ty);
+            if (tile.mode != DepthTiles::TILE_ROWS)
+                target.materialize_depth_tile(tx, ty);
+            tile.dirty = true;
+        }
+    }
+    return NULL;
+}
+
+// Recomputes zmin and zmax of a ROWS tile from the target's pixels of it
+template <class Depth>
+inline void rescanTile(RenderTarget &target, DepthTiles::Tile &tile, int tx, int ty)
+{
+    typedef typename Depth::Value Value;
+    const int T = DepthTiles::TILE_SIZE;
+    const int x1 = std::min(target.get_width(), tx * T + T), y1 = std::min(target.get_height(), ty * T + T);
+    Value lo = std::numeric_limits<Value>::max(), hi = 0;
+    for (int y = ty * T; y < y1; y++)
+    {
+        const Value *zrow = Depth::row(target, y) + target.column_offset(tx * T);
+        for (int x = 0; x < x1 - tx * T; x++)
+        {
+            lo = std::min(lo, zrow[x]);
+            hi = std::max(hi, zrow[x]);
+        }
+    }
+    tile.zmin = lo;
+    tile.zmax = hi;
+    tile.dirty = false;
+}
+
+// Called by the scanline rasterizers on a target with DepthTiles at the first row of each band
+// of 8 they draw. Every tile of the band the box overlaps is
+//  - skipped if its zmin is above every depth the triangle reaches in it, without reading it;
+//  - drawn here and skipped if the triangle covers all of it above its zmax: every fragment
+//    passes, so it is shaded without reading depth, and the tile takes the triangle's plane,
+//    or its 64 depths when the coverage has no plane, whatever it held before; a tile holding
+//    the triangle's own plane is shaded without a depth write under GREATER_EQUAL, or skipped;
+//  - otherwise expanded into the rows if it was CLEAR or PLANE, and left to the rows; its
+//    bounds are recomputed from them the next time a triangle reaches it.
+template <class Depth, class Coverage, class Shader>
+void beginTileBand(const Coverage &cov, int ty, int minX, int maxX, int minY, int maxY, RenderTarget &target,
+                   DepthTiles &tiles, bool equal, const Depth &depth, Shader &shade)
+{
+    typedef typename Depth::Value Value;
+    const int T = DepthTiles::TILE_SIZE;
+    const int y0 = std::max(minY, ty * T), y1 = std::min(maxY, ty * T + T - 1);
+    Vec3f bc;
+    float zf;
+    for (int tx = minX / T; tx <= maxX / T; tx++)
+    {
+        const int x0 = std::max(minX, tx * T), x1 = std::min(maxX, tx * T + T - 1);
+        DepthTiles::Tile &tile = tiles.tile(tx, ty);
+        tile.skip = true;
+        if (cov.misses(x0, y0, x1, y1))
+            continue;
+        const uint32_t top = (uint32_t)depth.encode(cov.maxDepth(x0, y0, x1, y1));
+        if (tile.dirty)
+            rescanTile<Depth>(target, tile, tx, ty);
+        if (top < tile.zmin)
+        {
+            tiles.count_rejected();
+            continue;
+        }
+
+        if (cov.exact && x0 == tx * T && x1 == x0 + T - 1 && y0 == ty * T && y1 == y0 + T - 1 &&
+            cov.covers(x0, y0, bc, zf) && cov.covers(x1, y0, bc, zf) && cov.covers(x0, y1, bc, zf) &&
+            cov.covers(x1, y1, bc, zf))
+        {
+            // Every fragment passes; z is written to the rows unless the tile keeps a plane
+            auto drawTile = [&](const Value *z)
+            {
+                for (int j = 0; j < T; j++)
+                {
+                    Value *zrow = z ? Depth::row(target, y0 + j) : NULL;
+                    uint32_t *crow = IsDepthOnly<Shader>::value ? NULL : target.color_row(y0 + j);
+                    for (int i = 0; i < T; i++)
+                    {
+                        if (z)
+                            zrow[target.column_offset(x0 + i)] = z[j * T + i];
+                        if constexpr (!IsDepthOnly<Shader>::value)
+                        {
+                            cov.covers(x0 + i, y0 + j, bc, zf);
+                            crow[target.column_offset(x0 + i)] = invokeShader(shade, bc, x0 + i, y0 + j);
+                        }
+                    }
+                }
+            };
+            // The triangle that stored the plane, as after a z-prepass: every fragment equals the
+            // stored depth, so all of them pass GREATER_EQUAL and none pass GREATER
+            if (cov.storedIn(tile))
+            {
+                if (equal)
+                    drawTile(NULL);
+                else
+                    tiles.count_rejected();
+                continue;
+            }
+            Value z[T * T];
+            Value lo = std::numeric_limits<Value>::max(), hi = 0;
+            for (int i = 0; i < T * T; i++)
+            {
+                cov.covers(x0 + i % T, y0 + i / T, bc, zf);
+                z[i] = depth.encode(zf);
+                lo = std::min(lo, z[i]);
+                hi = std::max(hi, z[i]);
+            }
+            if (equal ? lo >= tile.zmax : lo > tile.zmax)
+            {
+                drawTile(Coverage::planar ? NULL : z);
+                if constexpr (Coverage::planar)
+                {
+                    tile.plane = cov.plane;
+                    tile.mode = DepthTiles::TILE_PLANE;
+                }
+                else
+                    tile.mode = DepthTiles::TILE_ROWS;
+                tile.zmin = lo;
+                tile.zmax = hi;
+                continue;
+            }
+        }
+        tile.skip = false;
+        tile.dirty = true;
+        if (tile.mode != DepthTiles::TILE_ROWS)
+            target.materialize_depth_tile(tx, ty);
+    }
+}
+
+// Calls span(xa, xb) on the runs of [minX, maxX] in row y that the band left to the rows:
+// all of it without tiles, otherwise the tiles not skipped
+template <class Span>
+inline void forTileSpans(DepthTiles *tiles, int y, int minX, int maxX, Span &&span)
+{
+    if (!tiles)
+    {
+        span(minX, maxX);
+        return;
+    }
+    const int T = DepthTiles::TILE_SIZE;
+    for (int tx = minX / T; tx <= maxX / T;)
+    {
+        if (tiles->tile(tx, y / T).skip)
+        {
+            tx++;
+            continue;
+        }
+        int first = tx;
+        while (tx <= maxX / T && !tiles->tile(tx, y / T).skip)
+            tx++;
+        span(std::max(minX, first * T), std::min(maxX, tx * T - 1));
+    }
+}
+
+// Walks every pixel covered by the triangle, keeps the nearest depth (greater z wins)
+// and for every pixel that passes calls
+//   uint32_t shade(const Vec3f &bc)  or  uint32_t shade(const Vec3f &bc, int x, int y)
+// with the barycentric weights of t0, t1, t2; the packed color it returns is stored.
+// With a DepthOnly shader only the depth buffer is touched.
+template <class Depth, class Shader>
+void rasterizeFloat(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                    RenderTarget &target, const RasterConfig &config, const Depth &depth, Shader &&shade)
+{
+    const bool equal = config.depthTest == RasterConfig::GREATER_EQUAL;
+    FloatCoverage cov;
+    int minX, maxX, minY, maxY;
+    if (!cov.setup(t0, t1, t2, target, minX, maxX, minY, maxY))
+        return;
+    const FloatDepthPlane &plane = cov.plane;
+    DepthTiles *tiles = tilesForTriangle<Depth>(target, minX, maxX, minY, maxY);
+
+    Vec3f P;
+    for (P.y = minY; P.y <= maxY; P.y++)
+    {
+        if (tiles && ((int)P.y == minY || (int)P.y % DepthTiles::TILE_SIZE == 0))
+            beginTileBand(cov, (int)P.y / DepthTiles::TILE_SIZE, minX, maxX, minY, maxY, target, *tiles, equal, depth, shade);
+        uint32_t *crow = IsDepthOnly<Shader>::value ? NULL : target.color_row((int)P.y);
+        typename Depth::Value *zrow = Depth::row(target, (int)P.y);
+        const float rowZ = plane.row(P.y);
+        forTileSpans(tiles, (int)P.y, minX, maxX, [&](int xa, int xb)
+        {
+            for (P.x = xa; P.x <= xb; P.x++)
+            {
+                Vec3f bc = barycentric(t0, t1, t2, P);
+                if (bc.x < 0 || bc.y < 0 || bc.z < 0)
+                    continue;
+                P.z = plane.at(rowZ, P.x);
+                typename Depth::Value z = depth.encode(P.z);
+                int idx = target.column_offset((int)P.x);
+                if (depthPasses(zrow[idx], z, equal))
+                {
+                    zrow[idx] = z;
+                    if constexpr (!IsDepthOnly<Shader>::value)
+                        crow[idx] = invokeShader(shade, bc, (int)P.x, (int)P.y);
+                }
+            }
+        });
+    }
+}
+
+// Depth-only variant of rasterizeFloat(), without barycentric weights. Each row's span is
+// found from the triangle's edge functions, stepped per row in double precision and widened
+// by the float test's rounding error, and only its pixels are tested. The test evaluates barycentric()'s numerators
+// with the same float expressions and compares them without dividing; for whole-pixel
+// vertices, which is what the float path is given, every term is an exact integer, so the
+// coverage is barycentric()'s exactly. Depth comes from the same plane as rasterizeFloat()'s,
+// so a GREATER_EQUAL color pass after a z-prepass finds every visible fragment's depth equal.
+template <class Depth>
+void rasterizeFloatDepth(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                         RenderTarget &target, const RasterConfig &config, const Depth &depth)
+{
+    const bool equal = config.depthTest == RasterConfig::GREATER_EQUAL;
+    FloatDepthCoverage cov;
+    int minX, maxX, minY, maxY;
+    if (!cov.setup(t0, t1, t2, target, minX, maxX, minY, maxY))
+        return;
+    const FloatDepthPlane &plane = cov.plane;
+    const float area = cov.area;
+    DepthTiles *tiles = tilesForTriangle<Depth>(target, minX, maxX, minY, maxY);
+    DepthOnly none;
+
+    // barycentric() weighs t2 by ux, t1 by uy and t0 by area - ux - uy. As a * x + b * y + c,
+    // signed so that inside is positive, these are exact in double for float vertices.
+    const double sign = area > 0 ? 1.0 : -1.0;
+    double a[3], b[3], c[3];
+    a[0] = sign * (t1.y - t0.y);
+    b[0] = sign * -(double)(t1.x - t0.x);
+    c[0] = sign * ((double)(t1.x - t0.x) * t0.y - (double)t0.x * (t1.y - t0.y));
+    a[1] = sign * -(double)(t2.y - t0.y);
+    b[1] = sign * (double)(t2.x - t0.x);
+    c[1] = sign * ((double)t0.x * (t2.y - t0.y) - (double)(t2.x - t0.x) * t0.y);
+    a[2] = -a[0] - a[1];
+    b[2] = -b[0] - b[1];
+    c[2] = std::fabs(area) - c[0] - c[1];
+    // Margin for the float rounding of the per-pixel test, which only fractional vertices have
+    float extent = std::max({std::fabs(t1.x - t0.x), std::fabs(t1.y - t0.y), std::fabs(t2.x - t0.x),
+                             std::fabs(t2.y - t0.y), std::fabs(t0.x - minX), std::fabs(t0.x - maxX),
+                             std::fabs(t0.y - minY), std::fabs(t0.y - maxY), 1.f});
+    const double slack = (double)extent * extent * (1.0 / (1 << 20));
+    // Each edge bounds the span from the left (a > 0) or the right (a < 0); e is -(b * y + c)
+    // for the current row, so the edge crosses the row at x = e / a
+    double e[3], inv[3];
+    int left[3], right[3], nleft = 0, nright = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        e[k] = -(b[k] * minY + c[k]) - slack;
+        inv[k] = a[k] != 0 ? 1.0 / a[k] : 0.0;
+        if (a[k] > 0)
+            left[nleft++] = k;
+        else if (a[k] < 0)
+            right[nright++] = k;
+    }
+    const float s = cov.s, sarea = cov.sarea;
+
+    for (int y = minY; y <= maxY; y++, e[0] -= b[0], e[1] -= b[1], e[2] -= b[2])
+    {
+        if (tiles && (y == minY || y % DepthTiles::TILE_SIZE == 0))
+            beginTileBand(cov, y / DepthTiles::TILE_SIZE, minX, maxX, minY, maxY, target, *tiles, equal, depth, none);
+        // A horizontal edge excludes whole rows, which the bounding box already did
+        double lo = minX, hi = maxX;
+        for (int k = 0; k < nleft; k++)
+            lo = std::max(lo, std::ceil(e[left[k]] * inv[left[k]] - 1e-3));
+        for (int k = 0; k < nright; k++)
+            hi = std::min(hi, std::floor(e[right[k]] * inv[right[k]] + 1e-3));
+        if (lo > hi)
+            continue;
+        typename Depth::Value *zrow = Depth::row(target, y);
+        const float py = (float)y;
+        const float rowZ = plane.row(py);
+        forTileSpans(tiles, y, (int)lo, (int)hi, [&](int xa, int xb)
+        {
+            for (int x = xa; x <= xb; x++)
+            {
+                const float px = (float)x;
+                float ux = s * ((t1.x - t0.x) * (t0.y - py) - (t0.x - px) * (t1.y - t0.y));
+                float uy = s * ((t0.x - px) * (t2.y - t0.y) - (t2.x - t0.x) * (t0.y - py));
+                if (ux < 0 || uy < 0 || ux + uy > sarea)
+                    continue;
+                typename Depth::Value z = depth.encode(plane.at(rowZ, px));
+                int idx = target.column_offset(x);
+                if (depthPasses(zrow[idx], z, equal))
+                {
+                    zrow[idx] = z;
+                }
+            }
+        });
+    }
+}
+
+template <class Depth, class Shader>
+void rasterizeFixed(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                    RenderTarget &target, const RasterConfig &config, const Depth &depth, Shader &&shade)
+{
+    const bool equal = config.depthTest == RasterConfig::GREATER_EQUAL;
+    FixedCoverage cov;
+    int minX, maxX, minY, maxY;
+    if (!cov.setup(t0, t1, t2, config.subpixelBits, target, minX, maxX, minY, maxY))
+        return;
+    const FixedEdge &e0 = cov.tri.e0, &e1 = cov.tri.e1, &e2 = cov.tri.e2;
+    const int64_t one = cov.one, half = cov.half;
+    DepthTiles *tiles = tilesForTriangle<Depth>(target, minX, maxX, minY, maxY);
+
+    const float invArea = cov.tri.invArea;
+    const int64_t px = minX * one + half;
+    int64_t w0row = e0.at(px, minY * one + half);
+    int64_t w1row = e1.at(px, minY * one + half);
+    int64_t w2row = e2.at(px, minY * one + half);
+    const int64_t dx0 = e0.a * one, dx1 = e1.a * one, dx2 = e2.a * one;
+    const int64_t dy0 = e0.b * one, dy1 = e1.b * one, dy2 = e2.b * one;
+
+    for (int y = minY; y <= maxY; y++, w0row += dy0, w1row += dy1, w2row += dy2)
+    {
+        if (tiles && (y == minY || y % DepthTiles::TILE_SIZE == 0))
+            beginTileBand(cov, y / DepthTiles::TILE_SIZE, minX, maxX, minY, maxY, target, *tiles, equal, depth, shade);
+        uint32_t *crow = IsDepthOnly<Shader>::value ? NULL : target.color_row(y);
+        typename Depth::Value *zrow = Depth::row(target, y);
+        forTileSpans(tiles, y, minX, maxX, [&](int xa, int xb)
+        {
+            int64_t w0 = w0row + dx0 * (xa - minX), w1 = w1row + dx1 * (xa - minX), w2 = w2row + dx2 * (xa - minX);
+            for (int x = xa; x <= xb; x++, w0 += dx0, w1 += dx1, w2 += dx2)
+            {
+                if ((w0 + e0.bias) < 0 || (w1 + e1.bias) < 0 || (w2 + e2.bias) < 0)
+                    continue;
+                Vec3f bc(w0 * invArea, w1 * invArea, w2 * invArea);
+                typename Depth::Value z = depth.encode(t0.z * bc.x + t1.z * bc.y + t2.z * bc.z);
+                int idx = target.column_offset(x);
+                if (depthPasses(zrow[idx], z, equal))
+                {
+                    zrow[idx] = z;
+                    if constexpr (!IsDepthOnly<Shader>::value)
+                        crow[idx] = invokeShader(shade, bc, x, y);
+                }
+            }
+        });
+    }
+}
+
+// Multisampled variant: coverage and depth are resolved per sample, but shade() runs at most
+// once per pixel, at the pixel centre if it is covered, otherwise at the first covered sample.
+// The shaded color is stored into every sample that passed its depth test.
+template <class Depth, class Shader>
+void rasterizeFixedMSAA(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                        RenderTarget &target, const RasterConfig &config, const Depth &depth, Shader &&shade)
+{
+    // Sample offsets are in 1/16 pixel, so at least 4 sub-pixel bits are needed
+    const int bits = std::max(config.subpixelBits, 4);
+    const bool equal = config.depthTest == RasterConfig::GREATER_EQUAL;
+    FixedTriangle tri;
+    if (!tri.setup(t0, t1, t2, bits))
+        return;
+    const FixedEdge &e0 = tri.e0, &e1 = tri.e1, &e2 = tri.e2;
+    const int64_t one = (int64_t)1 << bits;
+    const int64_t half = one >> 1;
+    const int samples = target.get_samples();
+    const int(*pattern)[2] = samplePattern(samples);
+
+    // Per-sample edge offsets from the pixel centre
+    int64_t so0[8], so1[8], so2[8];
+    for (int s = 0; s < samples; s++)
+    {
+        int64_t ox = pattern[s][0] * (one / 16), oy = pattern[s][1] * (one / 16);
+        so0[s] = e0.a * ox + e0.b * oy;
+        so1[s] = e1.a * ox + e1.b * oy;
+        so2[s] = e2.a * ox + e2.b * oy;
+    }
+
+    // Any pixel overlapping the bounding box may have covered samples
+    int minX = (int)std::max<int64_t>(0, tri.fminX >> bits);
+    int maxX = (int)std::min<int64_t>(target.get_width() - 1, tri.fmaxX >> bits);
+    int minY = (int)std::max<int64_t>(0, tri.fminY >> bits);
+    int maxY = (int)std::min<int64_t>(target.get_height() - 1, tri.fmaxY >> bits);
+    if (minX > maxX || minY > maxY)
+        return;
+
+    const float invArea = tri.invArea;
+    const int64_t px = minX * one + half;
+    int64_t w0row = e0.at(px, minY * one + half);
+    int64_t w1row = e1.at(px, minY * one + half);
+    int64_t w2row = e2.at(px, minY * one + half);
+    const int64_t dx0 = e0.a * one, dx1 = e1.a * one, dx2 = e2.a * one;
+    const int64_t dy0 = e0.b * one, dy1 = e1.b * one, dy2 = e2.b * one;
+
+    for (int y = minY; y <= maxY; y++, w0row += dy0, w1row += dy1, w2row += dy2)
+    {
+        uint32_t *crow = IsDepthOnly<Shader>::value ? NULL : target.color_row(y);
+        typename Depth::Value *zrow = Depth::row(target, y);
+        int64_t w0 = w0row, w1 = w1row, w2 = w2row;
+        for (int x = minX; x <= maxX; x++, w0 += dx0, w1 += dx1, w2 += dx2)
+        {
+            int idx = target.column_offset(x);
+            unsigned passed = 0;
+            int first = -1;
+            for (int s = 0; s < samples; s++)
+            {
+                int64_t s0 = w0 + so0[s], s1 = w1 + so1[s], s2 = w2 + so2[s];
+                if ((s0 + e0.bias) < 0 || (s1 + e1.bias) < 0 || (s2 + e2.bias) < 0)
+                    continue;
+                if (first < 0)
+                    first = s;
+                typename Depth::Value z = depth.encode((t0.z * s0 + t1.z * s1 + t2.z * s2) * invArea);
+                if (depthPasses(zrow[idx + s], z, equal))
+                {
+                    zrow[idx + s] = z;
+                    passed |= 1u << s;
+                }
+            }
+            if constexpr (!IsDepthOnly<Shader>::value)
+            {
+                if (!passed)
+                    continue;
+                bool centre = (w0 + e0.bias) >= 0 && (w1 + e1.bias) >= 0 && (w2 + e2.bias) >= 0;
+                int64_t c0 = centre ? w0 : w0 + so0[first];
+                int64_t c1 = centre ? w1 : w1 + so1[first];
+                int64_t c2 = centre ? w2 : w2 + so2[first];
+                uint32_t color = invokeShader(shade, Vec3f(c0 * invArea, c1 * invArea, c2 * invArea), x, y);
+                for (int s = 0; s < samples; s++)
+                    if (passed & (1u << s))
+                        crow[idx + s] = color;
+            }
+        }
+    }
+}
+
+template <class Depth, class Shader>
+void rasterizeWith(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                   RenderTarget &target, const RasterConfig &config, const Depth &depth, Shader &&shade)
+{
+    if (target.get_samples() > 1)
+        rasterizeFixedMSAA(t0, t1, t2, target, config, depth, shade);
+    else if (config.mode == RasterConfig::FIXED)
+        rasterizeFixed(t0, t1, t2, target, config, depth, shade);
+    else if constexpr (IsDepthOnly<Shader>::value)
+        rasterizeFloatDepth(t0, t1, t2, target, config, depth);
+    else
+        rasterizeFloat(t0, t1, t2, target, config, depth, shade);
+}
+
+// Dispatches to the coverage mode selected with setRasterConfig() and the target's depth format.
+// Multisampled targets always take the fixed-point path.
+template <class Shader>
+void rasterize(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+               RenderTarget &target, Shader &&shade)
+{
+    const RasterConfig &config = rasterConfig();
+    switch (target.get_depth_format())
+    {
+    case RenderTarget::DEPTH_U24:
+        rasterizeWith(t0, t1, t2, target, config, DepthU24(target), shade);
+        break;
+    case RenderTarget::DEPTH_U16:
+        rasterizeWith(t0, t1, t2, target, config, DepthU16(target), shade);
+        break;
+    default:
+        rasterizeWith(t0, t1, t2, target, config, DepthF32(target), shade);
+        break;
+    }
+}
+
+// Depth-only pass, for shadow maps and z-prepasses. Compiled per ISA level in rasterizer.cpp.
+void rasterizeDepth(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, RenderTarget &target);
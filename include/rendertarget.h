@@ -0,0 +1,173 @@
+#ifndef __RENDERTARGET_H__
+#define __RENDERTARGET_H__
+
+#include <cstdint>
+#include "tgaimage.h"
+#include "depthtiles.h"
+
+// Color + depth target the rasterizers write into.
+// Color is packed 32-bit BGRA (same byte order as TGAColor::val), depth is a float per pixel.
+// Both buffers are 64-byte aligned and padded so clears can run on whole vectors.
+//
+// In TILED layout pixels are stored in 8x8 tiles. The pixel offset is still separable,
+// offset(x, y) = row_offset(y) + column_offset(x), so the rasterizers can fetch a row
+// pointer once per scanline and index it with column_offset() for either layout.
+//
+// A multisampled target keeps `samples` consecutive colors and depths per pixel;
+// offsets point at the first sample. resolve_colors() and resolve_depths() reduce a row to one
+// value per pixel; export_tga() and the image writers read rows through them.
+//
+// A DEPTH_ONLY target (shadow maps) has no color buffer; only depth_row() may be used.
+//
+// Depth is a float per pixel by default. DEPTH_U24 and DEPTH_U16 store it as unsigned
+// normalized integers instead (24 bits in a 32-bit word, or 16 bits): z in the range given to
+// set_depth_range() maps linearly onto 1 .. 2^bits - 1, nearer still greater, and 0 is left
+// for cleared pixels. The rasterizers test and write the encoded values directly.
+//
+// Single-sampled integer depth can also keep DepthTiles (set_depth_tiles()): clear() then
+// only marks the tiles, and the rasterizers reject triangles per tile and store fully covered
+// tiles as planes. The rows of tiles that are not in ROWS mode are stale; depth_at() and
+// resolve_depths() read through the tiles, and flush_depth_tiles() expands them all before the
+// rows are read directly.
+class RenderTarget
+{
+public:
+    enum Layout
+    {
+        LINEAR,
+        TILED
+    };
+    enum Buffers
+    {
+        COLOR_DEPTH,
+        DEPTH_ONLY
+    };
+    enum DepthFormat
+    {
+        DEPTH_F32,
+        DEPTH_U24,
+        DEPTH_U16
+    };
+    static const int TILE_SIZE = 8;
+
+private:
+    uint32_t *colors;
+    void *depths;
+    int width;
+    int height;
+    int pitch;  // pixels per row (LINEAR) or per tile row (TILED)
+    int npixels; // allocated pixels, including padding
+    int samples;
+    Layout layout;
+    DepthFormat depthFormat;
+    float zmin;       // z encoded as 1
+    float depthScale; // encoded steps per unit of z
+    uint32_t depthMax;
+    DepthTiles tiles;
+
+public:
+    RenderTarget(int w, int h, Layout l = LINEAR, int nsamples = 1, Buffers buffers = COLOR_DEPTH,
+                 DepthFormat depth = DEPTH_F32);
+    ~RenderTarget();
+    RenderTarget(const RenderTarget &) = delete;
+    RenderTarget &operator=(const RenderTarget &) = delete;
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    Layout get_layout() const { return layout; }
+    int get_samples() const { return samples; }
+    DepthFormat get_depth_format() const { return depthFormat; }
+
+    // z range mapped onto the integer formats, [-1, 1] by default; z outside it is clamped
+    void set_depth_range(float zNear, float zFar);
+    float get_depth_min() const { return zmin; }
+    float get_depth_scale() const { return depthScale; }
+    uint32_t get_depth_max() const { return depthMax; }
+
+    // Unsigned normalized encoding of z for DEPTH_U24 and DEPTH_U16
+    inline uint32_t encode_depth(float z) const
+    {
+        float v = (z - zmin) * depthScale + 1.5f;
+        return v <= 1.f ? 1u : (v >= (float)depthMax ? depthMax : (uint32_t)v);
+    }
+    // Depth of a pixel (its first sample) as z, whatever the format; cleared pixels of the
+    // integer formats read as -FLT_MAX
+    float depth_at(int x, int y) const;
+
+    // Unchecked addressing, callers must stay inside [0, width) x [0, height)
+    inline int row_offset(int y) const
+    {
+        if (layout == LINEAR)
+            return y * pitch * samples;
+        return ((y / TILE_SIZE) * pitch * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE) * samples;
+    }
+    inline int column_offset(int x) const
+    {
+        if (layout == LINEAR)
+            return x * samples;
+        return ((x / TILE_SIZE) * TILE_SIZE * TILE_SIZE + (x % TILE_SIZE)) * samples;
+    }
+    inline int offset(int x, int y) const { return row_offset(y) + column_offset(x); }
+
+    uint32_t *color_buffer() { return colors; }
+    const uint32_t *color_buffer() const { return colors; }
+    uint32_t *color_row(int y) { return colors + row_offset(y); }
+
+    // Depth rows in the target's format: depth_row() for DEPTH_F32, depth_row_u24() and
+    // depth_row_u16() for the integer formats
+    float *depth_row(int y) { return (float *)depths + row_offset(y); }
+    const float *depth_row(int y) const { return (const float *)depths + row_offset(y); }
+    uint32_t *depth_row_u24(int y) { return (uint32_t *)depths + row_offset(y); }
+    const uint32_t *depth_row_u24(int y) const { return (const uint32_t *)depths + row_offset(y); }
+    uint16_t *depth_row_u16(int y) { return (uint16_t *)depths + row_offset(y); }
+    const uint16_t *depth_row_u16(int y) const { return (const uint16_t *)depths + row_offset(y); }
+    size_t depth_bytes() const;
+
+    // NULL unless the target keeps depth tiles. They are off by default; set_depth_tiles(true)
+    // turns them on for single-sampled DEPTH_U24 and DEPTH_U16 targets and is ignored for
+    // others, set_depth_tiles(false) writes them out and drops them.
+    DepthTiles *depth_tiles() { return tiles.enabled() ? &tiles : NULL; }
+    const DepthTiles *depth_tiles() const { return tiles.enabled() ? &tiles : NULL; }
+    void set_depth_tiles(bool enabled);
+    // Writes a CLEAR or PLANE tile into the rows and makes it ROWS
+    void materialize_depth_tile(int tx, int ty);
+    void flush_depth_tiles();
+
+    // Fills every pixel with color and every depth with depth. The integer formats encode it,
+    // except that depths below the range, such as the default -FLT_MAX, clear to 0. With depth
+    // tiles the depth rows are not touched, every tile is marked CLEAR instead.
+    void clear(uint32_t color, float depth);
+    void clear();
+
+    // Copies the color buffer into image (RGB or RGBA), optionally flipping rows on the way.
+    // image is reallocated only if its size or format differs.
+    void export_tga(TGAImage &image, bool flip_vertically = false) const;
+
+    // Row y as one value per pixel in x order: colors average the samples, depth takes the
+    // nearest sample as z (cleared integer depth reads as -FLT_MAX). Points into the target
+    // when it is LINEAR, single-sampled and, for depth, DEPTH_F32; otherwise into tmp, which
+    // must hold width values.
+    const uint32_t *resolve_colors(int y, uint32_t *tmp) const;
+    const float *resolve_depths(int y, float *tmp) const;
+};
+
+// Rounded average of n packed BGRA colors, n a power of two up to 8
+inline uint32_t averageColors(const uint32_t *c, int n)
+{
+    if (n == 1)
+        return c[0];
+    // Two channels per 32-bit lane, 16 bits of headroom each
+    uint32_t rb = 0, ga = 0;
+    for (int i = 0; i < n; i++)
+    {
+        rb += c[i] & 0x00ff00ff;
+        ga += (c[i] >> 8) & 0x00ff00ff;
+    }
+    int shift = n == 2 ? 1 : (n == 4 ? 2 : 3);
+    uint32_t round = (uint32_t)(n >> 1) * 0x00010001;
+    rb = ((rb + round) >> shift) & 0x00ff00ff;
+    ga = ((ga + round) >> shift) & 0x00ff00ff;
+    return rb | (ga << 8);
+}
+
+#endif //__RENDERTARGET_H__
@@ -0,0 +1,20 @@
+// resample.h
+#pragma once
+#include <vector>
+#include "tgaimage.h"
+#include "imageview.h"
+
+enum ResampleFilter
+{
+    BOX,      // area average when downscaling, nearest when upscaling
+    BILINEAR, // tent filter, widened by the scale factor when downscaling
+    LANCZOS3  // windowed sinc, sharpest, may ring slightly at hard edges
+};
+
+// Separable resampler. Filter weights are precomputed per output row and column.
+// A horizontal pass reads every source row once and filters it into all the outputs at once,
+// then a vertical pass filters each output; both passes are split by rows over `threads`
+// threads (0: one per core). Pixels are processed as 4 floats, one SSE vector each.
+// Every image in dsts must already have its size and the same bytes per pixel as src.
+// The horizontal pass keeps dst width x src height x 4 floats per output in memory.
+bool resample(const ImageView &src, std::vector<TGAImage> &dsts, ResampleFilter filter, int threads = 0);
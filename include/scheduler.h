@@ -0,0 +1,92 @@
+// scheduler.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Work-stealing task graph.
+// A task runs once all the tasks it depends on have finished. Each worker thread owns a queue:
+// tasks made ready by a worker go to the back of its own queue and it pops from the back
+// (the data its predecessor just touched is still in cache); idle workers steal from the
+// front of the other queues. Tasks added from outside go to a shared queue, which the
+// thread calling wait() also serves.
+//
+// Every task is tagged with a stage name. Per stage the scheduler records how many tasks ran,
+// how long they sat ready in a queue before starting, how long they ran and the deepest
+// the queues got when one of them became ready; report() prints the table.
+class TaskScheduler
+{
+public:
+    typedef int TaskId;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Task
+    {
+        std::function<void()> fn;
+        int stage;
+        int pending; // unfinished dependencies, guarded by graphLock
+        bool done;
+        std::vector<Task *> successors;
+        Clock::time_point readyAt;
+    };
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task *> tasks;
+    };
+
+    struct StageStats
+    {
+        std::string name;
+        int tasks;
+        double queuedMs;
+        double maxQueuedMs;
+        double runMs;
+        int maxDepth;
+    };
+
+    std::vector<std::unique_ptr<Task>> graph; // tasks added since the last wait()
+    std::vector<std::unique_ptr<Queue>> queues; // one per worker, the last one shared
+    std::vector<std::thread> workers;
+    std::vector<StageStats> stages;
+    std::mutex graphLock;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    std::atomic<int> queued;
+    std::atomic<int> unfinished;
+    bool stopping;
+
+    void push(Task *task, int queue);
+    Task *pop(int queue);
+    void run(Task *task, int queue);
+    void workerLoop(int queue);
+    int stageIndex(const char *stage);
+
+public:
+    // threads workers plus the thread calling wait(); 0 uses one worker per core beyond the first
+    explicit TaskScheduler(int threads = 0);
+    ~TaskScheduler();
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    // Ids stay valid until wait() returns. May be called from inside a running task.
+    TaskId add(const char *stage, std::function<void()> fn, const std::vector<TaskId> &deps = std::vector<TaskId>());
+
+    // Helps run tasks until every task added so far has finished, then forgets them.
+    // Not to be called from inside a task.
+    void wait();
+
+    int thread_count() const { return (int)workers.size() + 1; }
+    void report(std::ostream &out) const;
+};
@@ -1,24 +1,42 @@
 // shaders.h
 #pragma once
 #include "tgaimage.h"
+#include "rendertarget.h"
 #include "geometry.h"
+#include "lighting.h"
+#include "shadow.h"
+#include "bctexture.h"
+#include "imageview.h"
 
 // Flat shading
 void flatShading(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
-                 TGAImage &image, const TGAColor &color, float *zbuffer);
+                 RenderTarget &target, const TGAColor &color);
 
 // Gouraud shading
 void gouraudShading(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
-                    TGAImage &image, const TGAColor &baseColor, float *zbuffer,
+                    RenderTarget &target, const TGAColor &baseColor,
                     float i0, float i1, float i2);
 
-// Phong shading
+// Phong shading. With a shadow map, diffuse and specular are scaled by the light's visibility.
+// With occlusion, the baked ambient visibility of the three vertices, the ambient term is
+// scaled by its interpolated value.
 void phongShading(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
-                  TGAImage &image, const TGAColor &baseColor, float *zbuffer,
+                  RenderTarget &target, const TGAColor &baseColor,
                   const Vec3f &n0, const Vec3f &n1, const Vec3f &n2,
-                  const Vec3f &lightDir);
+                  const Vec3f &lightDir, const ShadowMap *shadow = NULL, const Vec3f *occlusion = NULL);
 
-// Textured shading
+// Phong shading, intensity sampled from a PhongTable built for the current light
+void phongShading(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                  RenderTarget &target, const TGAColor &baseColor,
+                  const Vec3f &n0, const Vec3f &n1, const Vec3f &n2,
+                  const PhongTable &table, const ShadowMap *shadow = NULL);
+
+// Textured shading, sampled through a view so the texture can be flipped or cropped for free
+void addTextures(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                 const Vec2f &uv0, const Vec2f &uv1, const Vec2f &uv2,
+                 RenderTarget &target, const ImageView &texture);
+
+// Textured shading from a block-compressed texture
 void addTextures(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
                  const Vec2f &uv0, const Vec2f &uv1, const Vec2f &uv2,
-                 TGAImage &image, TGAImage &texture, float *zbuffer);
+                 RenderTarget &target, BC1Texture &texture);
@@ -0,0 +1,40 @@
+// shadow.h
+#pragma once
+#include "geometry.h"
+#include "model.h"
+#include "rendertarget.h"
+
+// Orthographic shadow map seen from a directional light, rendered with the depth-only
+// rasterizer. Depth grows towards the light, the same way the camera z-buffer grows
+// towards the viewer. lightDir follows the shaders' convention: surfaces facing -lightDir are lit.
+class ShadowMap
+{
+private:
+    RenderTarget depth;
+    int size;
+    Vec3f right, up, forward; // light basis, forward points at the light
+    float extent;             // half-size of the light's view volume, in model units
+    float bias;
+    int pcfRadius;
+    int screenWidth, screenHeight; // viewport of the camera pass, to map fragments back to model space
+    float screenOffset;            // first row of the target being shaded, for banded renders
+
+public:
+    ShadowMap(int size, const Vec3f &lightDir, float extent, int screenWidth, int screenHeight);
+
+    // Percentage-closer filtering over (2 * radius + 1)^2 texels, 0 for a single tap
+    void setFilter(int radius) { pcfRadius = radius; }
+
+    // Screen row that row 0 of the camera pass target corresponds to
+    void setScreenOffset(float rows) { screenOffset = rows; }
+
+    // Model-space point -> (shadow map x, shadow map y, depth)
+    Vec3f toLight(const Vec3f &v) const;
+
+    // Depth-only pass over every face of the model, using verts (one per model vertex) as the
+    // positions if given, e.g. after a per-frame transform
+    void render(Model &model, const Vec3f *verts = NULL);
+
+    // Fraction of light reaching a camera-pass fragment given in screen space, 0..1
+    float visibility(const Vec3f &screen) const;
+};
@@ -109,6 +109,32 @@ public:
     void clear();
 };
 
+class ImageView;
+
+// Writes a TGA file a band of rows at a time, bottom row first, so images far larger than
+// memory can be produced. Each row is RLE-compressed on its own (packets never cross rows).
+class TGAStreamWriter
+{
+private:
+    std::ofstream out;
+    int width;
+    int height;
+    int bytespp;
+    int rows;
+    bool rle;
+
+public:
+    TGAStreamWriter();
+    // Fails for sizes the 16-bit header fields can't hold
+    bool open(const char *filename, int w, int h, int bpp, bool rle = true);
+    // data holds nrows rows of width * bytespp bytes, lowest row first
+    bool write_rows(const unsigned char *data, int nrows);
+    // Writes every row of view, its row 0 first; contiguous rows are written without a copy
+    bool write_rows(const ImageView &view);
+    // Writes the footer; fails if fewer than height rows were written
+    bool close();
+};
+
 // void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage &image, TGAColor color);
 // void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage &image, TGAColor color, float z0, float z1, float z2, float *zbuffer);
 // void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage &image, TGAColor color,
@@ -0,0 +1,30 @@
+// wireframe.h
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "rendertarget.h"
+
+// Vertex pair of an edge, a < b
+struct Edge
+{
+    int a, b;
+};
+
+// Every edge of the model's faces once, however many faces share it and whatever their winding
+void extractEdges(Model &model, std::vector<Edge> &edges);
+
+// Sorts edges into bands of bandRows screen rows by the rows their endpoints span, as lists of
+// edge indices: band b holds binEdges[binStart[b], binStart[b + 1]). screen holds the screen
+// position of every vertex.
+void binEdges(const Vec3f *screen, const std::vector<Edge> &edges, int bandRows, int nbands,
+              std::vector<int> &binStart, std::vector<int> &binEdges);
+
+// Draws edges (indices into edges) as 1-pixel lines between their rounded screen positions,
+// writing color into rows [y0, y1) of target only. The pixels of a line depend only on its
+// endpoints, so bands can be drawn concurrently and give the same image as a single pass.
+// With depthTest, a pixel is drawn only where the line's interpolated z is within bias of
+// the target's depth or nearer; depth itself is never written. target must be single-sampled.
+void drawEdges(const Vec3f *screen, const Edge *edges, const int *indices, int count,
+               RenderTarget &target, int y0, int y1, uint32_t color, bool depthTest, float bias);
@@ -0,0 +1,106 @@
+// arena.cpp
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "arena.h"
+
+FrameArena::FrameArena(size_t size) : blocks(), blockSize(size), current(0), offset(0), used(0), peak(0)
+{
+}
+
+FrameArena::~FrameArena()
+{
+    for (Block &b : blocks)
+        std::free(b.data);
+}
+
+void *FrameArena::allocate(size_t bytes, size_t align)
+{
+    while (current < blocks.size())
+    {
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + bytes <= blocks[current].size)
+        {
+            offset = start + bytes;
+            used += bytes;
+            peak = std::max(peak, used);
+            return blocks[current].data + start;
+        }
+        current++;
+        offset = 0;
+    }
+    // Out of recycled blocks: grow. Only happens while the arena warms up.
+    Block b;
+    b.size = std::max(blockSize, (bytes + 63) & ~(size_t)63);
+    b.data = (char *)std::aligned_alloc(64, b.size);
+    blocks.push_back(b);
+    current = blocks.size() - 1;
+    offset = bytes;
+    used += bytes;
+    peak = std::max(peak, used);
+    return b.data;
+}
+
+void FrameArena::reset()
+{
+    current = 0;
+    offset = 0;
+    used = 0;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total = 0;
+    for (const Block &b : blocks)
+        total += b.size;
+    return total;
+}
+
+#ifndef NDEBUG
+// Debug builds count every global allocation so steady-state frames can assert they make none
+static std::atomic<size_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+size_t heapAllocations()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+#else
+size_t heapAllocations()
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,252 @@
+// bctexture.cpp
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "bctexture.h"
+
+namespace fs = std::filesystem;
+
+struct BC1Header
+{
+    char magic[8];
+    int32_t width, height;
+    int32_t flipped;
+};
+
+static const char bc1Magic[8] = {'T', 'R', 'B', 'C', '1', '0', '0', '1'};
+
+static uint16_t packRGB565(float r, float g, float b)
+{
+    int ri = std::min(31, std::max(0, (int)std::lround(r * 31.f / 255.f)));
+    int gi = std::min(63, std::max(0, (int)std::lround(g * 63.f / 255.f)));
+    int bi = std::min(31, std::max(0, (int)std::lround(b * 31.f / 255.f)));
+    return (uint16_t)((ri << 11) | (gi << 5) | bi);
+}
+
+static void unpackRGB565(uint16_t c, int &r, int &g, int &b)
+{
+    r = (c >> 11) & 31;
+    g = (c >> 5) & 63;
+    b = c & 31;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+}
+
+// The four-color palette of a block (c0 > c1 mode)
+static void blockPalette(uint16_t c0, uint16_t c1, int pal[4][3])
+{
+    unpackRGB565(c0, pal[0][0], pal[0][1], pal[0][2]);
+    unpackRGB565(c1, pal[1][0], pal[1][1], pal[1][2]);
+    for (int k = 0; k < 3; k++)
+    {
+        pal[2][k] = (2 * pal[0][k] + pal[1][k] + 1) / 3;
+        pal[3][k] = (pal[0][k] + 2 * pal[1][k] + 1) / 3;
+    }
+}
+
+BC1Texture::BC1Texture() : blocks(), width(0), height(0), blocksX(0), flipped(false)
+{
+    for (int i = 0; i < CACHE_BLOCKS; i++)
+        cacheTags[i] = -1;
+}
+
+void BC1Texture::decodeBlock(const Block &b, uint32_t *out) const
+{
+    int pal[4][3];
+    blockPalette(b.c0, b.c1, pal);
+    uint32_t packed[4];
+    for (int k = 0; k < 4; k++)
+        packed[k] = TGAColor(pal[k][0], pal[k][1], pal[k][2], 255).val;
+    for (int i = 0; i < 16; i++)
+        out[i] = packed[(b.indices >> (2 * i)) & 3];
+}
+
+void BC1Texture::encode(const ImageView &img)
+{
+    width = img.get_width();
+    height = img.get_height();
+    blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    blocks.assign((size_t)blocksX * blocksY, Block());
+    for (int i = 0; i < CACHE_BLOCKS; i++)
+        cacheTags[i] = -1;
+
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            // Gather the block, replicating edge texels for partial blocks
+            float px[16][3];
+            float mean[3] = {0, 0, 0};
+            for (int i = 0; i < 16; i++)
+            {
+                int x = std::min(width - 1, bx * 4 + (i & 3));
+                int y = std::min(height - 1, by * 4 + (i >> 2));
+                TGAColor c = img.get(x, y);
+                px[i][0] = c.r;
+                px[i][1] = c.g;
+                px[i][2] = c.b;
+                for (int k = 0; k < 3; k++)
+                    mean[k] += px[i][k] / 16.f;
+            }
+
+            // Principal axis of the block's colors by power iteration on the covariance
+            float cov[3][3] = {{0}};
+            for (int i = 0; i < 16; i++)
+                for (int r = 0; r < 3; r++)
+                    for (int c = 0; c < 3; c++)
+                        cov[r][c] += (px[i][r] - mean[r]) * (px[i][c] - mean[c]);
+            float axis[3] = {1, 1, 1};
+            for (int it = 0; it < 8; it++)
+            {
+                float next[3];
+                for (int r = 0; r < 3; r++)
+                    next[r] = cov[r][0] * axis[0] + cov[r][1] * axis[1] + cov[r][2] * axis[2];
+                float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+                if (len < 1e-6f)
+                    break;
+                for (int r = 0; r < 3; r++)
+                    axis[r] = next[r] / len;
+            }
+
+            // Endpoints at the extreme projections onto the axis
+            float lo = 1e30f, hi = -1e30f;
+            for (int i = 0; i < 16; i++)
+            {
+                float t = (px[i][0] - mean[0]) * axis[0] + (px[i][1] - mean[1]) * axis[1] + (px[i][2] - mean[2]) * axis[2];
+                lo = std::min(lo, t);
+                hi = std::max(hi, t);
+            }
+            uint16_t c0 = packRGB565(mean[0] + axis[0] * hi, mean[1] + axis[1] * hi, mean[2] + axis[2] * hi);
+            uint16_t c1 = packRGB565(mean[0] + axis[0] * lo, mean[1] + axis[1] * lo, mean[2] + axis[2] * lo);
+            if (c0 < c1)
+                std::swap(c0, c1);
+
+            Block &b = blocks[(size_t)by * blocksX + bx];
+            b.c0 = c0;
+            b.c1 = c1;
+            b.indices = 0;
+            if (c0 == c1)
+                continue; // flat block, every index 0
+            int pal[4][3];
+            blockPalette(c0, c1, pal);
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                float bestDist = 1e30f;
+                for (int k = 0; k < 4; k++)
+                {
+                    float dr = px[i][0] - pal[k][0], dg = px[i][1] - pal[k][1], db = px[i][2] - pal[k][2];
+                    float d = dr * dr + dg * dg + db * db;
+                    if (d < bestDist)
+                    {
+                        bestDist = d;
+                        best = k;
+                    }
+                }
+                b.indices |= (uint32_t)best << (2 * i);
+            }
+        }
+    }
+}
+
+bool BC1Texture::write(const char *filename) const
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "can't open file " + std::string(filename) + "\n";
+        return false;
+    }
+    BC1Header header;
+    memcpy(header.magic, bc1Magic, sizeof(bc1Magic));
+    header.width = width;
+    header.height = height;
+    header.flipped = flipped;
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)blocks.data(), blocks.size() * sizeof(Block));
+    out.close();
+    if (out.fail())
+    {
+        // Don't leave a truncated cache behind for the next run
+        std::remove(filename);
+        std::cerr << "can't write " + std::string(filename) + "\n";
+        return false;
+    }
+    return true;
+}
+
+bool BC1Texture::read(const char *filename)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+        return false;
+    std::streamoff fileSize = in.tellg();
+    in.seekg(0);
+    BC1Header header;
+    if (!in.read((char *)&header, sizeof(header)) || memcmp(header.magic, bc1Magic, sizeof(bc1Magic)))
+        return false;
+    // A corrupt or truncated cache must not size the blocks: the dimensions are those a TGA
+    // can have, and the file holds exactly their blocks
+    if (header.width <= 0 || header.height <= 0 || header.width > 65535 || header.height > 65535)
+        return false;
+    size_t nblocks = (size_t)((header.width + 3) / 4) * ((header.height + 3) / 4);
+    if (fileSize != (std::streamoff)(sizeof(header) + nblocks * sizeof(Block)))
+        return false;
+    width = header.width;
+    height = header.height;
+    flipped = header.flipped != 0;
+    blocksX = (width + 3) / 4;
+    blocks.resize(nblocks);
+    for (int i = 0; i < CACHE_BLOCKS; i++)
+        cacheTags[i] = -1;
+    return (bool)in.read((char *)blocks.data(), blocks.size() * sizeof(Block));
+}
+
+bool BC1Texture::load(const char *tgaPath, bool flipVertically, double *encodedPsnr)
+{
+    std::string cachePath = std::string(tgaPath) + ".bc1";
+    std::error_code ec;
+    if (fs::exists(cachePath, ec) && fs::last_write_time(cachePath, ec) >= fs::last_write_time(tgaPath, ec))
+    {
+        if (read(cachePath.c_str()) && flipped == flipVertically)
+            return true;
+    }
+
+    TGAImage img;
+    if (!img.read_tga_file(tgaPath))
+        return false;
+    ImageView source = flipVertically ? ImageView(img).flipped_vertically() : ImageView(img);
+    encode(source);
+    flipped = flipVertically;
+    if (encodedPsnr)
+        *encodedPsnr = psnr(source);
+    // The encoded texture is still used when the cache can't be written
+    if (!write(cachePath.c_str()))
+        std::cerr << "bc1 texture not cached, it will be encoded again next run\n";
+    return true;
+}
+
+double BC1Texture::psnr(const ImageView &img)
+{
+    double se = 0;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            TGAColor a = img.get(x, y);
+            TGAColor b(get(x, y), 4);
+            se += (a.r - b.r) * (a.r - b.r) + (a.g - b.g) * (a.g - b.g) + (a.b - b.b) * (a.b - b.b);
+        }
+    }
+    double mse = se / (3.0 * width * height);
+    if (mse == 0)
+        return INFINITY;
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,385 @@
+// bvh.cpp
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "bvh.h"
+#include "cpudispatch.h"
+
+#if defined(KERNEL_DISPATCH_X86)
+#include <immintrin.h>
+#endif
+
+static const int BINS = 16;
+static const int MAX_DEPTH = 64;
+static const float TRAVERSAL_COST = 1.f; // relative to one triangle test
+
+struct Bounds
+{
+    Vec3f lo, hi;
+
+    Bounds()
+        : lo(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+          hi(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max())
+    {
+    }
+    void grow(const Vec3f &p)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            lo.raw[k] = std::min(lo.raw[k], p.raw[k]);
+            hi.raw[k] = std::max(hi.raw[k], p.raw[k]);
+        }
+    }
+    void grow(const Bounds &b)
+    {
+        if (b.lo.x > b.hi.x)
+            return; // empty
+        grow(b.lo);
+        grow(b.hi);
+    }
+    float area() const
+    {
+        if (lo.x > hi.x)
+            return 0;
+        Vec3f d = hi - lo;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+struct BuildRef
+{
+    Bounds box;
+    Vec3f centroid;
+    int triangle;
+};
+
+static int binOf(const BuildRef &ref, int axis, float lo, float scale)
+{
+    return std::min(BINS - 1, (int)((ref.centroid.raw[axis] - lo) * scale));
+}
+
+// Fills nodes[index] from refs[first, first + count) and splits it while that is cheaper
+static void subdivide(std::vector<BVH::Node> &nodes, std::vector<BuildRef> &refs, int index,
+                      int first, int count, int level, int &depth)
+{
+    Bounds box, centroids;
+    for (int i = first; i < first + count; i++)
+    {
+        box.grow(refs[i].box);
+        centroids.grow(refs[i].centroid);
+    }
+    nodes[index].lo = box.lo;
+    nodes[index].hi = box.hi;
+    nodes[index].first = first;
+    nodes[index].count = count;
+    depth = std::max(depth, level);
+    if (count <= 2 || level >= MAX_DEPTH)
+        return;
+
+    // Cheapest bin boundary over the three axes, against the cost of a leaf
+    float area = box.area();
+    float bestCost = count * area;
+    int bestAxis = -1, bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo = centroids.lo.raw[axis];
+        float extent = centroids.hi.raw[axis] - lo;
+        if (extent <= 0)
+            continue;
+        float scale = BINS / extent;
+        Bounds bins[BINS];
+        int counts[BINS] = {0};
+        for (int i = first; i < first + count; i++)
+        {
+            int b = binOf(refs[i], axis, lo, scale);
+            counts[b]++;
+            bins[b].grow(refs[i].box);
+        }
+        float leftArea[BINS - 1];
+        int leftCount[BINS - 1];
+        Bounds acc;
+        int sum = 0;
+        for (int b = 0; b < BINS - 1; b++)
+        {
+            acc.grow(bins[b]);
+            sum += counts[b];
+            leftArea[b] = acc.area();
+            leftCount[b] = sum;
+        }
+        acc = Bounds();
+        sum = 0;
+        for (int b = BINS - 1; b > 0; b--)
+        {
+            acc.grow(bins[b]);
+            sum += counts[b];
+            float cost = TRAVERSAL_COST * area + leftCount[b - 1] * leftArea[b - 1] + sum * acc.area();
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+    if (bestAxis < 0)
+        return;
+
+    float lo = centroids.lo.raw[bestAxis];
+    float scale = BINS / (centroids.hi.raw[bestAxis] - lo);
+    BuildRef *mid = std::partition(&refs[first], &refs[first] + count, [&](const BuildRef &ref)
+    {
+        return binOf(ref, bestAxis, lo, scale) < bestSplit;
+    });
+    int leftCount = (int)(mid - &refs[first]);
+    if (leftCount == 0 || leftCount == count)
+        return;
+
+    int left = (int)nodes.size();
+    nodes.push_back(BVH::Node());
+    nodes.push_back(BVH::Node());
+    nodes[index].first = left;
+    nodes[index].count = 0;
+    subdivide(nodes, refs, left, first, leftCount, level + 1, depth);
+    subdivide(nodes, refs, left + 1, first + leftCount, count - leftCount, level + 1, depth);
+}
+
+BVH::BVH() : nodes(), triangles(), depth(0)
+{
+}
+
+void BVH::build(Model &model)
+{
+    int n = model.nfaces();
+    std::vector<BuildRef> refs(n);
+    for (int i = 0; i < n; i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        BuildRef &ref = refs[i];
+        for (int j = 0; j < 3; j++)
+            ref.box.grow(model.vert(face[j]));
+        ref.centroid = (model.vert(face[0]) + model.vert(face[1]) + model.vert(face[2])) * (1.f / 3.f);
+        ref.triangle = i;
+    }
+
+    nodes.clear();
+    depth = 0;
+    if (n == 0)
+        return;
+    nodes.reserve(2 * n);
+    nodes.push_back(Node());
+    subdivide(nodes, refs, 0, 0, n, 0, depth);
+
+    // Triangles in leaf order
+    triangles.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        const std::vector<int> &face = model.face(refs[i].triangle);
+        Vec3f v0 = model.vert(face[0]);
+        triangles[i].v0 = v0;
+        triangles[i].e1 = model.vert(face[1]) - v0;
+        triangles[i].e2 = model.vert(face[2]) - v0;
+    }
+}
+
+// Per-lane box and triangle tests on plain arrays. Every lane's result is combined with &
+// rather than &&, so the loops have no branches and the per-ISA builds can vectorize them.
+struct PacketLanes
+{
+    static const int N = RayPacket::SIZE;
+    const RayPacket &p;
+    float ix[N], iy[N], iz[N];
+
+    // Zero direction components become tiny ones, so the slabs never compute 0 * inf
+    explicit PacketLanes(const RayPacket &packet) : p(packet)
+    {
+        for (int i = 0; i < N; i++)
+        {
+            ix[i] = 1.f / (std::fabs(p.dx[i]) > 1e-20f ? p.dx[i] : 1e-20f);
+            iy[i] = 1.f / (std::fabs(p.dy[i]) > 1e-20f ? p.dy[i] : 1e-20f);
+            iz[i] = 1.f / (std::fabs(p.dz[i]) > 1e-20f ? p.dz[i] : 1e-20f);
+        }
+    }
+
+    // Slab test of every ray against the box
+    unsigned box(const BVH::Node &node) const
+    {
+        Vec3f lo = node.lo - p.origin, hi = node.hi - p.origin;
+        int hit[N];
+        for (int i = 0; i < N; i++)
+        {
+            float tx0 = lo.x * ix[i], tx1 = hi.x * ix[i];
+            float ty0 = lo.y * iy[i], ty1 = hi.y * iy[i];
+            float tz0 = lo.z * iz[i], tz1 = hi.z * iz[i];
+            float tnear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+            float tfar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+            hit[i] = (tnear <= tfar) & (tfar > 0) & (tnear < p.tmax);
+        }
+        unsigned mask = 0;
+        for (int i = 0; i < N; i++)
+            mask |= (unsigned)hit[i] << i;
+        return mask;
+    }
+
+    // Moller-Trumbore for every ray against one triangle; the origin terms are shared
+    unsigned triangle(const BVH::Triangle &t) const
+    {
+        Vec3f tvec = p.origin - t.v0;
+        Vec3f qvec = tvec ^ t.e1;
+        float qe2 = qvec * t.e2;
+        int hit[N];
+        for (int i = 0; i < N; i++)
+        {
+            float px = p.dy[i] * t.e2.z - p.dz[i] * t.e2.y;
+            float py = p.dz[i] * t.e2.x - p.dx[i] * t.e2.z;
+            float pz = p.dx[i] * t.e2.y - p.dy[i] * t.e2.x;
+            float det = t.e1.x * px + t.e1.y * py + t.e1.z * pz;
+            float inv = 1.f / det;
+            float u = (tvec.x * px + tvec.y * py + tvec.z * pz) * inv;
+            float v = (p.dx[i] * qvec.x + p.dy[i] * qvec.y + p.dz[i] * qvec.z) * inv;
+            float dist = qe2 * inv;
+            hit[i] = (std::fabs(det) > 1e-12f) & (u >= 0) & (v >= 0) & (u + v <= 1) & (dist > 0) & (dist < p.tmax);
+        }
+        unsigned mask = 0;
+        for (int i = 0; i < N; i++)
+            mask |= (unsigned)hit[i] << i;
+        return mask;
+    }
+};
+
+#if defined(KERNEL_DISPATCH_X86)
+// The same tests on one __m256 per quantity, lane i holding ray i. The operations and their
+// order match PacketLanes, so the hit masks are identical: _mm256_min_ps(b, a) and
+// _mm256_max_ps(b, a) pick what std::min(a, b) and std::max(a, b) pick.
+struct PacketLanesAvx2
+{
+    Vec3f origin;
+    __m256 dx, dy, dz, ix, iy, iz, tmax;
+
+    KERNEL_AVX2 explicit PacketLanesAvx2(const RayPacket &p) : origin(p.origin)
+    {
+        static_assert(RayPacket::SIZE == 8, "one ray per lane");
+        const __m256 tiny = _mm256_set1_ps(1e-20f), one = _mm256_set1_ps(1.f);
+        const __m256 signBit = _mm256_set1_ps(-0.f);
+        dx = _mm256_loadu_ps(p.dx);
+        dy = _mm256_loadu_ps(p.dy);
+        dz = _mm256_loadu_ps(p.dz);
+        ix = _mm256_div_ps(one, _mm256_blendv_ps(tiny, dx, _mm256_cmp_ps(_mm256_andnot_ps(signBit, dx), tiny, _CMP_GT_OQ)));
+        iy = _mm256_div_ps(one, _mm256_blendv_ps(tiny, dy, _mm256_cmp_ps(_mm256_andnot_ps(signBit, dy), tiny, _CMP_GT_OQ)));
+        iz = _mm256_div_ps(one, _mm256_blendv_ps(tiny, dz, _mm256_cmp_ps(_mm256_andnot_ps(signBit, dz), tiny, _CMP_GT_OQ)));
+        tmax = _mm256_set1_ps(p.tmax);
+    }
+
+    KERNEL_AVX2 unsigned box(const BVH::Node &node) const
+    {
+        Vec3f lo = node.lo - origin, hi = node.hi - origin;
+        __m256 tx0 = _mm256_mul_ps(_mm256_set1_ps(lo.x), ix), tx1 = _mm256_mul_ps(_mm256_set1_ps(hi.x), ix);
+        __m256 ty0 = _mm256_mul_ps(_mm256_set1_ps(lo.y), iy), ty1 = _mm256_mul_ps(_mm256_set1_ps(hi.y), iy);
+        __m256 tz0 = _mm256_mul_ps(_mm256_set1_ps(lo.z), iz), tz1 = _mm256_mul_ps(_mm256_set1_ps(hi.z), iz);
+        __m256 tnear = _mm256_max_ps(_mm256_min_ps(tz1, tz0),
+                                     _mm256_max_ps(_mm256_min_ps(ty1, ty0), _mm256_min_ps(tx1, tx0)));
+        __m256 tfar = _mm256_min_ps(_mm256_max_ps(tz1, tz0),
+                                    _mm256_min_ps(_mm256_max_ps(ty1, ty0), _mm256_max_ps(tx1, tx0)));
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ),
+                                   _mm256_and_ps(_mm256_cmp_ps(tfar, _mm256_setzero_ps(), _CMP_GT_OQ),
+                                                 _mm256_cmp_ps(tnear, tmax, _CMP_LT_OQ)));
+        return (unsigned)_mm256_movemask_ps(hit);
+    }
+
+    KERNEL_AVX2 unsigned triangle(const BVH::Triangle &t) const
+    {
+        Vec3f tvec = origin - t.v0;
+        Vec3f qvec = tvec ^ t.e1;
+        float qe2 = qvec * t.e2;
+        const __m256 e2x = _mm256_set1_ps(t.e2.x), e2y = _mm256_set1_ps(t.e2.y), e2z = _mm256_set1_ps(t.e2.z);
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.e1.x), px),
+                                                 _mm256_mul_ps(_mm256_set1_ps(t.e1.y), py)),
+                                   _mm256_mul_ps(_mm256_set1_ps(t.e1.z), pz));
+        __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+        __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tvec.x), px),
+                                                             _mm256_mul_ps(_mm256_set1_ps(tvec.y), py)),
+                                               _mm256_mul_ps(_mm256_set1_ps(tvec.z), pz)),
+                                 inv);
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, _mm256_set1_ps(qvec.x)),
+                                                             _mm256_mul_ps(dy, _mm256_set1_ps(qvec.y))),
+                                               _mm256_mul_ps(dz, _mm256_set1_ps(qvec.z))),
+                                 inv);
+        __m256 dist = _mm256_mul_ps(_mm256_set1_ps(qe2), inv);
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 hit = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), det), _mm256_set1_ps(1e-12f), _CMP_GT_OQ);
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.f), _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, zero, _CMP_GT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tmax, _CMP_LT_OQ));
+        return (unsigned)_mm256_movemask_ps(hit);
+    }
+};
+#endif
+
+// Depth-first walk shared by every ISA level; Lanes supplies the 8-ray tests
+template <class Lanes>
+static inline unsigned traverse(const BVH::Node *nodes, const BVH::Triangle *triangles, const Lanes &lanes)
+{
+    const unsigned all = (1u << RayPacket::SIZE) - 1;
+    unsigned live = all;
+    int stack[MAX_DEPTH + 2];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        const BVH::Node &node = nodes[stack[--sp]];
+        if (!(lanes.box(node) & live))
+            continue;
+        if (node.count > 0)
+        {
+            for (int k = 0; k < node.count; k++)
+                live &= ~lanes.triangle(triangles[node.first + k]);
+            if (!live)
+                return all;
+        }
+        else
+        {
+            stack[sp++] = node.first + 1;
+            stack[sp++] = node.first;
+        }
+    }
+    return all & ~live;
+}
+
+static unsigned traversePacketGeneric(const BVH::Node *nodes, const BVH::Triangle *triangles, const RayPacket &p)
+{
+    return traverse(nodes, triangles, PacketLanes(p));
+}
+
+#if defined(KERNEL_DISPATCH_X86)
+KERNEL_SSE42 static unsigned traversePacketSse42(const BVH::Node *nodes, const BVH::Triangle *triangles, const RayPacket &p)
+{
+    return traverse(nodes, triangles, PacketLanes(p));
+}
+
+KERNEL_AVX2 static unsigned traversePacketAvx2(const BVH::Node *nodes, const BVH::Triangle *triangles, const RayPacket &p)
+{
+    return traverse(nodes, triangles, PacketLanesAvx2(p));
+}
+#endif
+
+static unsigned traversePacket(const BVH::Node *nodes, const BVH::Triangle *triangles, const RayPacket &p)
+{
+#if defined(KERNEL_DISPATCH_X86)
+    static unsigned (*const kernel)(const BVH::Node *, const BVH::Triangle *, const RayPacket &) =
+        selectKernel(traversePacketGeneric, traversePacketSse42, traversePacketAvx2);
+    return kernel(nodes, triangles, p);
+#else
+    return traversePacketGeneric(nodes, triangles, p);
+#endif
+}
+
+unsigned BVH::occluded(const RayPacket &packet) const
+{
+    if (nodes.empty())
+        return 0;
+    return traversePacket(nodes.data(), triangles.data(), packet);
+}
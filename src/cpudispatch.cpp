@@ -0,0 +1,72 @@
+// cpudispatch.cpp
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "cpudispatch.h"
+
+static CpuLevel detectLevel()
+{
+#if defined(KERNEL_DISPATCH_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"))
+        return CPU_AVX2;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return CPU_SSE42;
+#endif
+    return CPU_GENERIC;
+}
+
+static CpuLevel detectedLevel()
+{
+    static const CpuLevel level = detectLevel();
+    return level;
+}
+
+static CpuLevel chooseLevel()
+{
+    CpuLevel level = detectedLevel();
+    const char *requested = std::getenv("TINYRENDERER_ISA");
+    if (!requested)
+        return level;
+    for (int l = CPU_GENERIC; l <= CPU_AVX2; l++)
+    {
+        if (strcmp(requested, cpuLevelName((CpuLevel)l)) == 0)
+        {
+            if (l > level)
+                std::cerr << "TINYRENDERER_ISA=" << requested << " not supported by this cpu, using "
+                          << cpuLevelName(level) << "\n";
+            return (CpuLevel)std::min((int)level, l);
+        }
+    }
+    std::cerr << "unknown TINYRENDERER_ISA " << requested << ", expected generic, sse4.2 or avx2\n";
+    return level;
+}
+
+CpuLevel cpuLevel()
+{
+    static const CpuLevel level = chooseLevel();
+    return level;
+}
+
+const char *cpuLevelName(CpuLevel level)
+{
+    switch (level)
+    {
+    case CPU_SSE42:
+        return "sse4.2";
+    case CPU_AVX2:
+        return "avx2";
+    default:
+        return "generic";
+    }
+}
+
+const char *cpuDispatchReport()
+{
+    static char report[96];
+    snprintf(report, sizeof(report), "kernels: %s (cpu supports %s)", cpuLevelName(cpuLevel()),
+             cpuLevelName(detectedLevel()));
+    return report;
+}
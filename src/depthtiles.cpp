@@ -0,0 +1,39 @@
+// depthtiles.cpp
+#include <algorithm>
+#include "depthtiles.h"
+
+DepthTiles::DepthTiles() : tiles(), tilesX(0), tilesY(0), clearValue(0), rejected(0)
+{
+}
+
+void DepthTiles::resize(int width, int height, uint32_t zmax)
+{
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    Tile rows = {};
+    rows.zmin = 0;
+    rows.zmax = zmax;
+    rows.mode = TILE_ROWS;
+    rows.dirty = true;
+    tiles.assign((size_t)tilesX * tilesY, rows);
+    if (tiles.empty())
+        tiles.shrink_to_fit();
+}
+
+void DepthTiles::clear(uint32_t value)
+{
+    clearValue = value;
+    rejected = 0;
+    for (Tile &t : tiles)
+    {
+        t.zmin = value;
+        t.zmax = value;
+        t.mode = TILE_CLEAR;
+        t.dirty = false;
+    }
+}
+
+int DepthTiles::tile_count(Mode mode) const
+{
+    return (int)std::count_if(tiles.begin(), tiles.end(), [mode](const Tile &t) { return t.mode == mode; });
+}
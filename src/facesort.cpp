@@ -0,0 +1,87 @@
+// facesort.cpp
+#include <algorithm>
+#include <limits>
+#include "facesort.h"
+#include "rasterizer.h"
+
+FaceSorter::FaceSorter() : keys(), keysTmp(), order(), orderTmp(), count(0)
+{
+}
+
+void FaceSorter::sort(Model &model, const Vec3f *verts, const Vec3f &viewDir)
+{
+    int n = model.nfaces();
+    keys.resize(n);
+    keysTmp.resize(n);
+    order.resize(n);
+    orderTmp.resize(n);
+
+    // Front faces and their nearest depth (greater z is nearer), staged in orderTmp / the z range
+    float zmin = std::numeric_limits<float>::max(), zmax = -std::numeric_limits<float>::max();
+    count = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        Vec3f v0 = verts[face[0]];
+        Vec3f v1 = verts[face[1]];
+        Vec3f v2 = verts[face[2]];
+        if (((v2 - v0) ^ (v1 - v0)) * viewDir <= 0)
+            continue;
+        float z = std::max({v0.z, v1.z, v2.z});
+        zmin = std::min(zmin, z);
+        zmax = std::max(zmax, z);
+        orderTmp[count++] = i;
+    }
+    float scale = zmax > zmin ? 65535.f / (zmax - zmin) : 0.f;
+    for (int k = 0; k < count; k++)
+    {
+        const std::vector<int> &face = model.face(orderTmp[k]);
+        float z = std::max({verts[face[0]].z, verts[face[1]].z, verts[face[2]].z});
+        keysTmp[k] = (uint16_t)((zmax - z) * scale);
+    }
+
+    // Low byte, then high byte; each pass is stable
+    for (int shift = 0; shift < 16; shift += 8)
+    {
+        const uint16_t *srcKeys = shift == 0 ? keysTmp.data() : keys.data();
+        const int *srcOrder = shift == 0 ? orderTmp.data() : order.data();
+        uint16_t *dstKeys = shift == 0 ? keys.data() : keysTmp.data();
+        int *dstOrder = shift == 0 ? order.data() : orderTmp.data();
+        int offsets[256] = {0};
+        for (int k = 0; k < count; k++)
+            offsets[(srcKeys[k] >> shift) & 0xff]++;
+        for (int b = 0, sum = 0; b < 256; b++)
+        {
+            int c = offsets[b];
+            offsets[b] = sum;
+            sum += c;
+        }
+        for (int k = 0; k < count; k++)
+        {
+            int slot = offsets[(srcKeys[k] >> shift) & 0xff]++;
+            dstKeys[slot] = srcKeys[k];
+            dstOrder[slot] = srcOrder[k];
+        }
+    }
+    // The second pass wrote into the Tmp buffers
+    order.swap(orderTmp);
+    keys.swap(keysTmp);
+}
+
+uint64_t countShadedFragments(Model &model, const Vec3f *screen, const int *faces, int count,
+                              RenderTarget &scratch)
+{
+    scratch.clear();
+    uint64_t shaded = 0;
+    for (int k = 0; k < count; k++)
+    {
+        const std::vector<int> &face = model.face(faces[k]);
+        const Vec3f &s0 = screen[face[0]], &s1 = screen[face[1]], &s2 = screen[face[2]];
+        rasterize(s0, s1, s2, scratch, [&](const Vec3f &)
+        {
+            shaded++;
+            return 0u;
+        });
+    }
+    return shaded;
+}
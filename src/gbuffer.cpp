@@ -0,0 +1,121 @@
+// gbuffer.cpp
+#include <algorithm>
+#include "gbuffer.h"
+#include "rasterizer.h"
+#include "cpudispatch.h"
+
+GBuffer::GBuffer(int w, int h)
+    : width(w), height(h), faces((size_t)w * h), barys((size_t)w * h), normals((size_t)w * h),
+      uvs((size_t)w * h), albedos((size_t)w * h)
+{
+    clear();
+}
+
+void GBuffer::clear()
+{
+    std::fill(faces.begin(), faces.end(), -1);
+    std::fill(albedos.begin(), albedos.end(), 0);
+}
+
+size_t GBuffer::memory() const
+{
+    return faces.size() * (sizeof(int) + 2 * sizeof(Vec3f) + sizeof(Vec2f) + sizeof(uint32_t));
+}
+
+static inline uint32_t sampleTexture(const ImageView &texture, const Vec2f &uv)
+{
+    int tex_x = std::min(texture.get_width() - 1, std::max(0, (int)(uv.x * texture.get_width())));
+    int tex_y = std::min(texture.get_height() - 1, std::max(0, (int)(uv.y * texture.get_height())));
+    return texture.get(tex_x, tex_y).val;
+}
+
+// Same interpolation as the forward shaders, so a pass reproduces their output exactly
+static inline void gbufferFaceImpl(int face, const Vec3f &t0, const Vec3f &t1, const Vec3f &t2,
+                                   const Vec3f &n0, const Vec3f &n1, const Vec3f &n2,
+                                   const Vec2f &uv0, const Vec2f &uv1, const Vec2f &uv2,
+                                   RenderTarget &target, GBuffer &gbuffer, const ImageView *texture,
+                                   const TGAColor &color)
+{
+    rasterize(t0, t1, t2, target, [&](const Vec3f &bc, int x, int y)
+    {
+        Vec2f uv = uv0 * bc.x + uv1 * bc.y + uv2 * bc.z;
+        uint32_t albedo = texture ? sampleTexture(*texture, uv) : color.val;
+        gbuffer.face_row(y)[x] = face;
+        gbuffer.bary_row(y)[x] = bc;
+        gbuffer.normal_row(y)[x] = n0 * bc.x + n1 * bc.y + n2 * bc.z;
+        gbuffer.uv_row(y)[x] = uv;
+        gbuffer.albedo_row(y)[x] = albedo;
+        return albedo;
+    });
+}
+
+static inline void relightRowsImpl(const GBuffer &gbuffer, const RelightMesh &mesh, RelightMode mode,
+                                   const Vec3f &lightDir, const PhongParams &params, const ImageView *texture,
+                                   int y0, int y1, TGAImage &image)
+{
+    const int width = gbuffer.get_width();
+    const int height = gbuffer.get_height();
+    unsigned char *out = image.buffer();
+    for (int y = y0; y < y1; y++)
+    {
+        const int *faces = gbuffer.face_row(y);
+        const Vec3f *barys = gbuffer.bary_row(y);
+        const Vec3f *normals = gbuffer.normal_row(y);
+        const Vec2f *uvs = gbuffer.uv_row(y);
+        const uint32_t *albedos = gbuffer.albedo_row(y);
+        unsigned char *dst = out + (size_t)(height - 1 - y) * width * 3;
+        for (int x = 0; x < width; x++, dst += 3)
+        {
+            int face = faces[x];
+            if (face < 0)
+            {
+                dst[0] = dst[1] = dst[2] = 0;
+                continue;
+            }
+            float intensity;
+            switch (mode)
+            {
+            case RELIGHT_FLAT:
+                intensity = std::max(0.f, mesh.faceNormals[face] * lightDir);
+                break;
+            case RELIGHT_GOURAUD:
+            {
+                const int *v = mesh.faceVerts + 3 * face;
+                float i0 = std::max(0.f, mesh.vertexNormals[v[0]] * lightDir);
+                float i1 = std::max(0.f, mesh.vertexNormals[v[1]] * lightDir);
+                float i2 = std::max(0.f, mesh.vertexNormals[v[2]] * lightDir);
+                const Vec3f &bc = barys[x];
+                intensity = i0 * bc.x + i1 * bc.y + i2 * bc.z;
+                break;
+            }
+            default:
+            {
+                PhongParams p = params;
+                if (mesh.occlusion)
+                {
+                    const int *v = mesh.faceVerts + 3 * face;
+                    const Vec3f &bc = barys[x];
+                    p.ambient *= mesh.occlusion[v[0]] * bc.x + mesh.occlusion[v[1]] * bc.y + mesh.occlusion[v[2]] * bc.z;
+                }
+                intensity = phongIntensity(normals[x], lightDir, p);
+                break;
+            }
+            }
+            TGAColor albedo(texture ? sampleTexture(*texture, uvs[x]) : albedos[x], 4);
+            dst[0] = (unsigned char)(albedo.b * intensity);
+            dst[1] = (unsigned char)(albedo.g * intensity);
+            dst[2] = (unsigned char)(albedo.r * intensity);
+        }
+    }
+}
+
+DISPATCH_KERNEL(void, gbufferFace, gbufferFaceImpl,
+                (int face, const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, const Vec3f &n0, const Vec3f &n1,
+                 const Vec3f &n2, const Vec2f &uv0, const Vec2f &uv1, const Vec2f &uv2, RenderTarget &target,
+                 GBuffer &gbuffer, const ImageView *texture, const TGAColor &color),
+                (face, t0, t1, t2, n0, n1, n2, uv0, uv1, uv2, target, gbuffer, texture, color))
+
+DISPATCH_KERNEL(void, relightRows, relightRowsImpl,
+                (const GBuffer &gbuffer, const RelightMesh &mesh, RelightMode mode, const Vec3f &lightDir,
+                 const PhongParams &params, const ImageView *texture, int y0, int y1, TGAImage &image),
+                (gbuffer, mesh, mode, lightDir, params, texture, y0, y1, image))
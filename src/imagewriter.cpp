@@ -0,0 +1,183 @@
+// imagewriter.cpp
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "imagewriter.h"
+
+static bool openOutput(std::ofstream &out, const char *filename)
+{
+    out.open(filename, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Target row holding output row j, for formats that store the top row first
+static int topDownRow(const RenderTarget &target, int j, bool flip_vertically)
+{
+    return flip_vertically ? target.get_height() - 1 - j : j;
+}
+
+static void putBigEndian32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+bool write_qoi(const RenderTarget &target, const char *filename, bool flip_vertically)
+{
+    std::ofstream out;
+    if (!openOutput(out, filename))
+        return false;
+    int width = target.get_width();
+    int height = target.get_height();
+
+    unsigned char header[14] = {'q', 'o', 'i', 'f'};
+    putBigEndian32(header + 4, width);
+    putBigEndian32(header + 8, height);
+    header[12] = 3; // RGB
+    header[13] = 0; // sRGB with linear alpha
+    out.write((const char *)header, sizeof(header));
+
+    // Pixels are compared as packed BGRA with alpha forced to 255, as 3-channel QOI requires
+    uint32_t index[64] = {0};
+    uint32_t prev = 0xff000000;
+    int run = 0;
+    long long remaining = (long long)width * height;
+    std::vector<uint32_t> tmp(width);
+    std::vector<unsigned char> bytes(width * 5 + 8); // worst case 5 bytes per pixel, plus the end marker
+    for (int j = 0; j < height; j++)
+    {
+        const uint32_t *row = target.resolve_colors(topDownRow(target, j, flip_vertically), tmp.data());
+        unsigned char *p = bytes.data();
+        for (int x = 0; x < width; x++)
+        {
+            uint32_t px = row[x] | 0xff000000;
+            remaining--;
+            if (px == prev)
+            {
+                run++;
+                if (run == 62 || remaining == 0)
+                {
+                    *p++ = 0xc0 | (run - 1); // QOI_OP_RUN
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                *p++ = 0xc0 | (run - 1);
+                run = 0;
+            }
+            int r = (px >> 16) & 0xff, g = (px >> 8) & 0xff, b = px & 0xff;
+            int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (index[hash] == px)
+            {
+                *p++ = hash; // QOI_OP_INDEX
+            }
+            else
+            {
+                index[hash] = px;
+                signed char dr = (signed char)(r - ((prev >> 16) & 0xff));
+                signed char dg = (signed char)(g - ((prev >> 8) & 0xff));
+                signed char db = (signed char)(b - (prev & 0xff));
+                int drdg = dr - dg, dbdg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                {
+                    *p++ = 0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2); // QOI_OP_DIFF
+                }
+                else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 && dbdg >= -8 && dbdg <= 7)
+                {
+                    *p++ = 0x80 | (dg + 32); // QOI_OP_LUMA
+                    *p++ = ((drdg + 8) << 4) | (dbdg + 8);
+                }
+                else
+                {
+                    *p++ = 0xfe; // QOI_OP_RGB
+                    *p++ = r;
+                    *p++ = g;
+                    *p++ = b;
+                }
+            }
+            prev = px;
+        }
+        if (j == height - 1)
+        {
+            static const unsigned char endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+            p = std::copy(endMarker, endMarker + 8, p);
+        }
+        out.write((const char *)bytes.data(), p - bytes.data());
+    }
+    if (!out.good())
+    {
+        std::cerr << "can't write the qoi file\n";
+        return false;
+    }
+    return true;
+}
+
+bool write_ppm(const RenderTarget &target, const char *filename, bool flip_vertically)
+{
+    std::ofstream out;
+    if (!openOutput(out, filename))
+        return false;
+    int width = target.get_width();
+    int height = target.get_height();
+    char header[64];
+    int n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    out.write(header, n);
+
+    std::vector<uint32_t> tmp(width);
+    std::vector<unsigned char> bytes(width * 3);
+    for (int j = 0; j < height; j++)
+    {
+        const uint32_t *row = target.resolve_colors(topDownRow(target, j, flip_vertically), tmp.data());
+        unsigned char *p = bytes.data();
+        for (int x = 0; x < width; x++, p += 3)
+        {
+            p[0] = (row[x] >> 16) & 0xff;
+            p[1] = (row[x] >> 8) & 0xff;
+            p[2] = row[x] & 0xff;
+        }
+        out.write((const char *)bytes.data(), bytes.size());
+    }
+    if (!out.good())
+    {
+        std::cerr << "can't write the ppm file\n";
+        return false;
+    }
+    return true;
+}
+
+bool write_pfm_depth(const RenderTarget &target, const char *filename, bool flip_vertically)
+{
+    std::ofstream out;
+    if (!openOutput(out, filename))
+        return false;
+    int width = target.get_width();
+    int height = target.get_height();
+    char header[64];
+    int n = snprintf(header, sizeof(header), "Pf\n%d %d\n-1.0\n", width, height); // negative scale: little-endian
+    out.write(header, n);
+
+    // PFM stores the bottom row first, the opposite of PPM and QOI
+    std::vector<float> tmp(width);
+    for (int j = 0; j < height; j++)
+    {
+        const float *row = target.resolve_depths(flip_vertically ? j : height - 1 - j, tmp.data());
+        out.write((const char *)row, width * sizeof(float));
+    }
+    if (!out.good())
+    {
+        std::cerr << "can't write the pfm file\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+// lighting.cpp
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "lighting.h"
+
+float phongIntensity(Vec3f normal, const Vec3f &lightDir, const PhongParams &params)
+{
+    float n_dot_l = std::max(0.0f, normal.normalize() * lightDir);
+    float diffuse = n_dot_l * params.diffuse;
+    Vec3f reflectDir = (normal * (2.f * n_dot_l) - lightDir).normalize();
+    float specular = std::pow(std::max(0.0f, reflectDir * params.viewDir), params.shininess) * params.specular;
+    return std::min(1.0f, params.ambient + diffuse + specular);
+}
+
+PhongTable::PhongTable() : table(), resolution(0), lightDir(0, 0, -1), params()
+{
+}
+
+void PhongTable::build(const Vec3f &light, int res, const PhongParams &p)
+{
+    resolution = std::max(2, res);
+    lightDir = light;
+    params = p;
+    table.resize(resolution * resolution);
+    for (int y = 0; y < resolution; y++)
+    {
+        for (int x = 0; x < resolution; x++)
+        {
+            // Unfold the texel centre back onto the octahedron
+            float u = (x + 0.5f) / resolution * 2.f - 1.f;
+            float v = (y + 0.5f) / resolution * 2.f - 1.f;
+            Vec3f n(u, v, 1.f - std::fabs(u) - std::fabs(v));
+            if (n.z < 0)
+            {
+                n.x = (1.f - std::fabs(v)) * (u < 0 ? -1.f : 1.f);
+                n.y = (1.f - std::fabs(u)) * (v < 0 ? -1.f : 1.f);
+            }
+            table[y * resolution + x] = phongIntensity(n, lightDir, params);
+        }
+    }
+}
+
+void PhongTable::measureError(int nsamples, float &maxError, float &meanError) const
+{
+    std::mt19937 gen(12345);
+    std::normal_distribution<float> dis(0.f, 1.f);
+    maxError = 0;
+    double sum = 0;
+    for (int i = 0; i < nsamples; i++)
+    {
+        Vec3f n(dis(gen), dis(gen), dis(gen));
+        if (n.norm() < 1e-6f)
+            continue;
+        float err = std::fabs(lookup(n) - phongIntensity(n, lightDir, params));
+        maxError = std::max(maxError, err);
+        sum += err;
+    }
+    meanError = nsamples > 0 ? (float)(sum / nsamples) : 0.f;
+}
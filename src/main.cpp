@@ -1,108 +1,722 @@
 // main.cpp
 #include <iostream>
-#include <map>
+#include <cassert>
+#include <cmath>
 #include <limits>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
+#include "rendertarget.h"
+#include "rasterizer.h"
 #include "shaders.h" // Our new shading module
+#include "shadow.h"
+#include "meshstream.h"
+#include "arena.h"
+#include "imagewriter.h"
+#include "resample.h"
+#include "scheduler.h"
+#include "cpudispatch.h"
+#include "gbuffer.h"
+#include "occlusion.h"
+#include "wireframe.h"
+#include "facesort.h"
 
 // Global config
-static const int width = 800;
-static const int height = 800;
+static int width = 800;
+static int height = 800;
 
 // Some example colors
 static const TGAColor white(255, 255, 255, 255);
 static const TGAColor materialColor(139, 69, 19, 255);
 
-// Light direction
-static const Vec3f light_dir(0, 0, -1);
+// View direction, used for back-face culling
+static const Vec3f view_dir(0, 0, -1);
 
-// Convert from [-1..1] in model space to screen space
-Vec3f world2screen(const Vec3f &v)
+// Convert from [-1..1] in model space to screen space.
+// The float rasterizer wants whole pixels, the fixed-point one snaps to its own sub-pixel grid.
+Vec3f world2screen(const Vec3f &v, bool subpixel)
 {
+    if (subpixel)
+        return Vec3f((v.x + 1.f) * width / 2.f,
+                     (v.y + 1.f) * height / 2.f,
+                     v.z);
     return Vec3f(int((v.x + 1.f) * width / 2.f + 0.5f),
                  int((v.y + 1.f) * height / 2.f + 0.5f),
                  v.z);
 }
 
-int main(int argc, char **argv)
+enum Shading
+{
+    FLAT,
+    GOURAUD,
+    PHONG,
+    TEXTURE
+};
+
+enum OutputFormat
+{
+    TGA,
+    QOI,
+    PPM,
+    PFM
+};
+
+enum WireframeMode
+{
+    NO_WIREFRAME,
+    WIREFRAME_ALL,    // every edge
+    WIREFRAME_HIDDEN, // edges not hidden by the model's faces
+    WIREFRAME_OVERLAY // visible edges over the shaded frame
+};
+
+// Depth slack for hidden-line tests: a line along a face is interpolated along the edge,
+// the face's depth across it, so the two differ slightly near silhouettes
+static const float wireframeBias = 0.02f;
+
+static const char *outputExtensions[] = {"tga", "qoi", "ppm", "pfm"};
+
+// Writes the frame (or its depth, for PFM) to assets/outputs/diablo3_pose_output.<ext>, or to
+// assets/outputs/diablo3_pose_frame_<frame>.<ext> when a frame number is given.
+// Target row 0 is the bottom of the picture.
+static bool saveFrame(const RenderTarget &target, OutputFormat format, TGAImage &image, int frame = -1)
 {
-    // Load model
-    Model *model = nullptr;
-    if (argc == 2)
+    std::string path = frame < 0 ? std::string("assets/outputs/diablo3_pose_output.")
+                                 : "assets/outputs/diablo3_pose_frame_" + std::to_string(frame) + ".";
+    path += outputExtensions[format];
+    switch (format)
     {
-        model = new Model(argv[1]);
+    case TGA:
+        // Flip rows while packing into the TGA
+        target.export_tga(image, true);
+        return image.write_tga_file(path.c_str());
+    case QOI:
+        return write_qoi(target, path.c_str(), true);
+    case PPM:
+        return write_ppm(target, path.c_str(), true);
+    case PFM:
+        return write_pfm_depth(target, path.c_str(), true);
     }
-    else
+    return false;
+}
+
+// Downsizes image to every width in widths (keeping the aspect ratio) in one resampler pass,
+// and writes each as assets/outputs/diablo3_pose_output_<w>x<h>.tga
+static bool saveThumbnails(TGAImage &image, const std::vector<int> &widths, ResampleFilter filter)
+{
+    typedef std::chrono::steady_clock Clock;
+    std::vector<TGAImage> thumbnails;
+    thumbnails.reserve(widths.size());
+    for (int w : widths)
     {
-        model = new Model("assets/models/diablo3_pose.obj");
+        int h = std::max(1, (int)std::lround((double)w * image.get_height() / image.get_width()));
+        thumbnails.push_back(TGAImage(w, h, image.get_bytespp()));
     }
+    Clock::time_point start = Clock::now();
+    if (!resample(ImageView(image), thumbnails, filter))
+        return false;
+    std::cerr << thumbnails.size() << " thumbnails in "
+              << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms\n";
+    for (TGAImage &t : thumbnails)
+    {
+        std::string path = "assets/outputs/diablo3_pose_output_" + std::to_string(t.get_width()) + "x" +
+                           std::to_string(t.get_height()) + ".tga";
+        if (!t.write_tga_file(path.c_str()))
+            return false;
+    }
+    return true;
+}
 
-    // Load texture
-    TGAImage texture;
-    texture.read_tga_file("assets/models/diablo3_pose_nm.tga");
-    texture.flip_vertically();
+// Renders the model chunk by chunk from a MeshStream, keeping mesh memory within budget bytes.
+// Vertex normals would need the whole mesh, so only flat and textured shading are available.
+static bool renderStreamed(const char *modelPath, size_t budget, Shading shading, RenderTarget &target,
+                           const ImageView &texture, bool subpixel, const Vec3f &light_dir)
+{
+    if (shading != FLAT && shading != TEXTURE)
+    {
+        std::cerr << "--stream supports flat and texture shading only\n";
+        return false;
+    }
+    MeshStream stream;
+    if (!stream.open(modelPath, budget))
+        return false;
 
-    // Prepare z-buffer
-    float *zbuffer = new float[width * height];
-    for (int i = 0; i < width * height; i++)
+    std::vector<StreamTriangle> chunk;
+    chunk.reserve(stream.chunk_size());
+    while (stream.next(chunk) > 0)
     {
-        zbuffer[i] = -std::numeric_limits<float>::max();
+        for (const StreamTriangle &t : chunk)
+        {
+            Vec3f normal = ((t.v[2] - t.v[0]) ^ (t.v[1] - t.v[0])).normalize();
+            if (normal * view_dir <= 0)
+                continue; // skip back-facing
+            Vec3f s0 = world2screen(t.v[0], subpixel);
+            Vec3f s1 = world2screen(t.v[1], subpixel);
+            Vec3f s2 = world2screen(t.v[2], subpixel);
+            if (shading == FLAT)
+            {
+                float intensity = std::max(0.f, normal * light_dir);
+                TGAColor flatColor(
+                    (unsigned char)(materialColor.r * intensity),
+                    (unsigned char)(materialColor.g * intensity),
+                    (unsigned char)(materialColor.b * intensity),
+                    255);
+                flatShading(s0, s1, s2, target, flatColor);
+            }
+            else
+            {
+                addTextures(s0, s1, s2, t.uv[0], t.uv[1], t.uv[2], target, texture);
+            }
+        }
     }
+    std::cerr << "stream memory " << (stream.memory() >> 10) << " KiB, page misses " << stream.page_misses() << "\n";
+    return true;
+}
 
-    // Create output image
-    TGAImage image(width, height, TGAImage::RGB);
+// Usage: tinyrenderer [model.obj] [options]
+//   --shading mode    flat, gouraud, phong or texture (default)
+//   --phong-lut res   phong from a res x res precomputed intensity table instead of per pixel
+//   --subpixel bits   fixed-point rasterization with 1..16 sub-pixel bits (default: float)
+//   --msaa samples    2, 4 or 8 samples per pixel, shaded once per pixel and resolved on export
+//   --depth fmt       depth buffer format: f32 (default), u24 or u16 over the model's z range
+//   --tiled           store the color/depth target in 8x8 tiles instead of rows
+//   --depth-tiles     with u24 or u16: per-tile min/max rejection, fast clears and plane tiles
+//   --light x y z     light direction (default 0 0 -1, i.e. from the camera)
+//   --shadows size    phong with a size x size shadow map rendered from the light
+//   --pcf radius      filter shadow lookups over (2 * radius + 1)^2 texels
+//   --ao rays         phong ambient scaled by occlusion baked per vertex (cached as <model>.ao)
+//   --zprepass        depth-only pass first, so the color pass shades only visible fragments
+//   --sort            draw front faces nearest first, and report the overdraw saved
+//   --stream MB       stream triangles from disk within an MB memory budget (flat or texture)
+//   --bc1             sample a BC1 block-compressed copy of the texture (cached as <texture>.bc1)
+//   --size w h        output resolution (default 800 800)
+//   --bands rows      render rows-high bands one at a time, streaming each into the output file
+//   --frames n        render n frames, turning the model about Y; the last frame is saved
+//   --format fmt      output tga (default), qoi, ppm, or pfm (the depth buffer)
+//   --thumbnails w... also write the frame downsized to each width w
+//   --filter f        thumbnail filter: box, bilinear or lanczos (default)
+//   --pipeline        overlap the transform, raster and encode stages of consecutive frames,
+//                     saving every frame as assets/outputs/diablo3_pose_frame_<k>.<ext>
+//   --threads n       scheduler threads besides the main one (default: one per extra core)
+//   --wireframe mode  draw unique edges: all, hidden (hidden-line removal) or overlay (over the shading)
+//   --relight n       rasterize a G-buffer once, then light it from n directions turning about Y
+//   --materials m     with --relight, also sweep m Phong shininess values per light
+int main(int argc, char **argv)
+{
+    typedef std::chrono::steady_clock Clock;
+    const char *modelPath = "assets/models/diablo3_pose.obj";
+    Shading shading = TEXTURE;
+    int phongLut = 0;
+    RasterConfig raster;
+    int samples = 1;
+    RenderTarget::DepthFormat depthFormat = RenderTarget::DEPTH_F32;
+    RenderTarget::Layout layout = RenderTarget::LINEAR;
+    bool depthTiles = false;
+    Vec3f light_dir(0, 0, -1);
+    size_t streamBudget = 0;
+    int bandRows = 0;
+    bool compressTexture = false;
+    int shadowSize = 0;
+    int pcfRadius = 0;
+    OcclusionParams occlusionParams;
+    bool bakeAO = false;
+    bool zprepass = false;
+    bool sortFaces = false;
+    int frames = 1;
+    OutputFormat format = TGA;
+    std::vector<int> thumbnailWidths;
+    ResampleFilter thumbnailFilter = LANCZOS3;
+    bool pipeline = false;
+    int threads = 0;
+    int relights = 0;
+    int materials = 1;
+    WireframeMode wireframe = NO_WIREFRAME;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--shading" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            if (mode == "flat")
+                shading = FLAT;
+            else if (mode == "gouraud")
+                shading = GOURAUD;
+            else if (mode == "phong")
+                shading = PHONG;
+            else if (mode == "texture")
+                shading = TEXTURE;
+            else
+            {
+                std::cerr << "unknown shading " << mode << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--phong-lut" && i + 1 < argc)
+        {
+            phongLut = std::max(2, std::atoi(argv[++i]));
+        }
+        else if (arg == "--subpixel" && i + 1 < argc)
+        {
+            raster.mode = RasterConfig::FIXED;
+            raster.subpixelBits = std::max(1, std::min(16, std::atoi(argv[++i])));
+        }
+        else if (arg == "--msaa" && i + 1 < argc)
+        {
+            samples = std::atoi(argv[++i]);
+            if (samples != 2 && samples != 4 && samples != 8)
+            {
+                std::cerr << "--msaa takes 2, 4 or 8\n";
+                return 1;
+            }
+        }
+        else if (arg == "--tiled")
+        {
+            layout = RenderTarget::TILED;
+        }
+        else if (arg == "--depth-tiles")
+        {
+            depthTiles = true;
+        }
+        else if (arg == "--depth" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "f32")
+                depthFormat = RenderTarget::DEPTH_F32;
+            else if (name == "u24")
+                depthFormat = RenderTarget::DEPTH_U24;
+            else if (name == "u16")
+                depthFormat = RenderTarget::DEPTH_U16;
+            else
+            {
+                std::cerr << "unknown depth format " << name << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--light" && i + 3 < argc)
+        {
+            light_dir = Vec3f(std::atof(argv[i + 1]), std::atof(argv[i + 2]), std::atof(argv[i + 3]));
+            light_dir.normalize();
+            i += 3;
+        }
+        else if (arg == "--shadows" && i + 1 < argc)
+        {
+            shadowSize = std::max(16, std::atoi(argv[++i]));
+        }
+        else if (arg == "--pcf" && i + 1 < argc)
+        {
+            pcfRadius = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--ao" && i + 1 < argc)
+        {
+            // Whole packets of rays
+            occlusionParams.rays = (std::max(1, std::atoi(argv[++i])) + RayPacket::SIZE - 1) / RayPacket::SIZE * RayPacket::SIZE;
+            bakeAO = true;
+        }
+        else if (arg == "--stream" && i + 1 < argc)
+        {
+            streamBudget = (size_t)std::max(1, std::atoi(argv[++i])) << 20;
+        }
+        else if (arg == "--size" && i + 2 < argc)
+        {
+            width = std::max(1, std::atoi(argv[i + 1]));
+            height = std::max(1, std::atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if (arg == "--bands" && i + 1 < argc)
+        {
+            bandRows = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--bc1")
+        {
+            compressTexture = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            frames = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--format" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            int f = 0;
+            while (f <= PFM && name != outputExtensions[f])
+                f++;
+            if (f > PFM)
+            {
+                std::cerr << "unknown format " << name << "\n";
+                return 1;
+            }
+            format = (OutputFormat)f;
+        }
+        else if (arg == "--thumbnails")
+        {
+            while (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+                thumbnailWidths.push_back(std::atoi(argv[++i]));
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "box")
+                thumbnailFilter = BOX;
+            else if (name == "bilinear")
+                thumbnailFilter = BILINEAR;
+            else if (name == "lanczos")
+                thumbnailFilter = LANCZOS3;
+            else
+            {
+                std::cerr << "unknown filter " << name << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--pipeline")
+        {
+            pipeline = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--relight" && i + 1 < argc)
+        {
+            relights = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--materials" && i + 1 < argc)
+        {
+            materials = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--wireframe" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            if (mode == "all")
+                wireframe = WIREFRAME_ALL;
+            else if (mode == "hidden")
+                wireframe = WIREFRAME_HIDDEN;
+            else if (mode == "overlay")
+                wireframe = WIREFRAME_OVERLAY;
+            else
+            {
+                std::cerr << "unknown wireframe mode " << mode << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--zprepass")
+        {
+            zprepass = true;
+        }
+        else if (arg == "--sort")
+        {
+            sortFaces = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            std::cerr << "unknown option " << arg << "\n";
+            return 1;
+        }
+        else
+        {
+            modelPath = argv[i];
+        }
+    }
+    setRasterConfig(raster);
+    std::cerr << cpuDispatchReport() << "\n";
 
-    // Compute vertex normals by averaging adjacent face normals
-    std::vector<Vec3f> vertexNormals(model->nverts(), Vec3f(0, 0, 0));
-    std::map<int, std::vector<int>> vertexToFaces;
+    int subpixelLimit = maxSubpixelBits(std::max({width, height, shadowSize}));
+    if ((raster.mode == RasterConfig::FIXED || samples > 1) && raster.subpixelBits > subpixelLimit)
+    {
+        std::cerr << "--subpixel takes at most " << subpixelLimit << " bits at this size\n";
+        return 1;
+    }
+    if (streamBudget > 0 && compressTexture)
+    {
+        std::cerr << "--stream samples the uncompressed texture and can't be combined with --bc1\n";
+        return 1;
+    }
+    if (streamBudget > 0 && bandRows > 0)
+    {
+        std::cerr << "--stream and --bands can't be combined\n";
+        return 1;
+    }
+    if (bandRows > 0 && (frames > 1 || pipeline))
+    {
+        std::cerr << "--frames and --bands can't be combined\n";
+        return 1;
+    }
+    if (bandRows > 0 && (format != TGA || !thumbnailWidths.empty()))
+    {
+        std::cerr << "--bands writes a full-size tga only\n";
+        return 1;
+    }
+    if (depthFormat != RenderTarget::DEPTH_F32 && (samples > 1 || streamBudget > 0))
+    {
+        std::cerr << "--depth u24 and u16 can't be combined with --msaa or --stream\n";
+        return 1;
+    }
+    if (depthTiles && depthFormat == RenderTarget::DEPTH_F32)
+    {
+        std::cerr << "--depth-tiles needs --depth u24 or u16\n";
+        return 1;
+    }
+    if (shadowSize > 0 && shading != PHONG)
+    {
+        std::cerr << "--shadows needs --shading phong\n";
+        return 1;
+    }
+    if (pcfRadius > 0 && shadowSize == 0)
+    {
+        std::cerr << "--pcf needs --shadows\n";
+        return 1;
+    }
+    if (bakeAO && (shading != PHONG || phongLut > 0 || streamBudget > 0))
+    {
+        std::cerr << "--ao needs --shading phong without --phong-lut or --stream\n";
+        return 1;
+    }
+    if (relights > 0 && (streamBudget > 0 || bandRows > 0 || frames > 1 || pipeline || samples > 1 ||
+                         shadowSize > 0 || phongLut > 0 || compressTexture))
+    {
+        std::cerr << "--relight can't be combined with --stream, --bands, --frames, --pipeline, --msaa, "
+                     "--shadows, --phong-lut or --bc1\n";
+        return 1;
+    }
+    if (wireframe != NO_WIREFRAME && (streamBudget > 0 || bandRows > 0 || frames > 1 || pipeline || samples > 1 || relights > 0))
+    {
+        std::cerr << "--wireframe can't be combined with --stream, --bands, --frames, --pipeline, --msaa or --relight\n";
+        return 1;
+    }
+    if (materials > 1 && (relights == 0 || shading == FLAT || shading == GOURAUD))
+    {
+        std::cerr << "--materials needs --relight with phong or texture shading\n";
+        return 1;
+    }
+    if (sortFaces && (streamBudget > 0 || relights > 0 || wireframe == WIREFRAME_ALL || wireframe == WIREFRAME_HIDDEN))
+    {
+        std::cerr << "--sort can't be combined with --stream, --relight or --wireframe all|hidden\n";
+        return 1;
+    }
+    if (relights > 0 && (format != TGA || !thumbnailWidths.empty()))
+    {
+        std::cerr << "--relight writes full-size tga files only\n";
+        return 1;
+    }
+
+    // Assets load as a task graph: the texture, its BC1 copy, the model and the Phong table are
+    // independent and load concurrently; normals and the shadow map wait for the model.
+    TaskScheduler scheduler(threads);
+    Clock::time_point loadStart = Clock::now();
+    std::atomic<bool> loadFailed(false);
 
-    // Map each vertex to faces that contain it
-    for (int i = 0; i < model->nfaces(); i++)
+    const char *texturePath = "assets/models/diablo3_pose_nm.tga";
+    TGAImage textureImage;
+    ImageView texture;
+    if (!compressTexture)
     {
-        std::vector<int> face = model->face(i);
-        for (int j = 0; j < 3; j++)
+        scheduler.add("load texture", [&]()
         {
-            vertexToFaces[face[j]].push_back(i);
-        }
+            textureImage.read_tga_file(texturePath);
+            // uv v grows upward, the image rows downward: sample through a flipped view
+            texture = ImageView(textureImage).flipped_vertically();
+        });
     }
 
-    // Accumulate face normals per vertex
-    for (int vertIdx = 0; vertIdx < model->nverts(); vertIdx++)
+    // Block-compressed copy instead, from the on-disk cache when it is current; the TGA is only
+    // read (and measured against) when the cache has to be rebuilt
+    BC1Texture bc1;
+    if (compressTexture)
     {
-        const std::vector<int> &faces = vertexToFaces[vertIdx];
-        Vec3f sumNormal(0, 0, 0);
-        for (int faceIdx : faces)
+        scheduler.add("load bc1", [&]()
         {
-            std::vector<int> face = model->face(faceIdx);
-            Vec3f v0 = model->vert(face[0]);
-            Vec3f v1 = model->vert(face[1]);
-            Vec3f v2 = model->vert(face[2]);
-            Vec3f normal = (v2 - v0) ^ (v1 - v0);
-            sumNormal = sumNormal + normal.normalize();
+            double psnr = NAN;
+            if (!bc1.load(texturePath, true, &psnr))
+            {
+                loadFailed = true;
+                return;
+            }
+            std::ostringstream line;
+            line << "bc1 texture " << (bc1.memory() >> 10) << " KiB (32-bit " << ((bc1.get_width() * bc1.get_height() * 4) >> 10)
+                 << " KiB), ";
+            if (std::isnan(psnr))
+                line << "from cache\n";
+            else
+                line << "encoded, PSNR " << psnr << " dB\n";
+            std::cerr << line.str();
+        });
+    }
+
+    // Phong intensity table for this light (its accuracy is checked by tests/test_phong_table.cpp)
+    PhongTable phongTable;
+    if (shading == PHONG && phongLut > 0)
+    {
+        scheduler.add("phong table", [&]()
+        {
+            phongTable.build(light_dir, phongLut);
+        });
+    }
+
+    // The mesh itself, unless it is streamed from disk
+    Model *model = NULL;
+    std::vector<Vec3f> vertexNormals;
+    BVH bvh;
+    std::vector<float> occlusion;
+    ShadowMap *shadow = nullptr;
+    if (streamBudget == 0)
+    {
+        TaskScheduler::TaskId modelTask = scheduler.add("load model", [&]()
+        {
+            model = new Model(modelPath);
+        });
+
+        // Vertex normals: adjacent face normals accumulated per vertex, in face order
+        TaskScheduler::TaskId normalsTask = scheduler.add("normals", [&]()
+        {
+            vertexNormals.assign(model->nverts(), Vec3f(0, 0, 0));
+            for (int i = 0; i < model->nfaces(); i++)
+            {
+                const std::vector<int> &face = model->face(i);
+                Vec3f v0 = model->vert(face[0]);
+                Vec3f v1 = model->vert(face[1]);
+                Vec3f v2 = model->vert(face[2]);
+                Vec3f normal = (v2 - v0) ^ (v1 - v0);
+                normal.normalize();
+                for (int j = 0; j < 3; j++)
+                    vertexNormals[face[j]] = vertexNormals[face[j]] + normal;
+            }
+            for (Vec3f &n : vertexNormals)
+                n.normalize();
+        }, {modelTask});
+
+        // Ambient occlusion from the cache, or baked: a BVH over the model, then vertex ranges
+        // traced as tasks of their own, then the cache is written once all of them are done
+        if (bakeAO)
+        {
+            scheduler.add("ao cache", [&]()
+            {
+                if (readOcclusionCache(modelPath, model->nverts(), occlusionParams, occlusion))
+                    return;
+                Clock::time_point start = Clock::now();
+                float extent = 0;
+                for (int i = 0; i < model->nverts(); i++)
+                    extent = std::max(extent, model->vert(i).norm());
+                bvh.build(*model);
+                occlusion.resize(model->nverts());
+                const int chunk = 64;
+                std::vector<TaskScheduler::TaskId> bakes;
+                for (int first = 0; first < model->nverts(); first += chunk)
+                {
+                    bakes.push_back(scheduler.add("ao bake", [&, first, extent]()
+                    {
+                        bakeOcclusion(bvh, *model, vertexNormals.data(), extent, occlusionParams,
+                                      first, std::min(model->nverts(), first + chunk), occlusion.data());
+                    }));
+                }
+                scheduler.add("ao write", [&, start]()
+                {
+                    // The bake is still used for this render when the cache can't be written
+                    bool cached = writeOcclusionCache(modelPath, occlusionParams, occlusion);
+                    std::ostringstream line;
+                    line << "ambient occlusion baked: " << model->nverts() << " vertices x " << occlusionParams.rays
+                         << " rays, bvh " << bvh.node_count() << " nodes, depth " << bvh.max_depth() << ", "
+                         << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms"
+                         << (cached ? "" : ", not cached") << "\n";
+                    std::cerr << line.str();
+                }, bakes);
+            }, {normalsTask});
+        }
+
+        // Shadow map: depth-only pass from the light over the whole model
+        if (shading == PHONG && shadowSize > 0)
+        {
+            scheduler.add("shadow map", [&]()
+            {
+                float extent = 0;
+                for (int i = 0; i < model->nverts(); i++)
+                    extent = std::max(extent, model->vert(i).norm());
+                shadow = new ShadowMap(shadowSize, light_dir, extent, width, height);
+                shadow->setFilter(pcfRadius);
+                shadow->render(*model);
+            }, {modelTask});
         }
-        vertexNormals[vertIdx] = sumNormal.normalize();
     }
+    scheduler.wait();
+    if (loadFailed)
+        return 1;
+    std::cerr << "assets loaded in " << std::chrono::duration<double, std::milli>(Clock::now() - loadStart).count()
+              << " ms on " << scheduler.thread_count() << " threads\n";
 
-    // Render loop
-    for (int i = 0; i < model->nfaces(); i++)
+    // Color + depth target, cleared to black and -inf depth. Banded renders only hold one band.
+    // Integer depth spans the model's bounding sphere, which turning about Y keeps in range.
+    RenderTarget target(width, bandRows > 0 ? std::min(bandRows, height) : height, layout, samples,
+                        RenderTarget::COLOR_DEPTH, depthFormat);
+    if (depthTiles)
+    {
+        // Cleared again so the first frame starts from CLEAR tiles too
+        target.set_depth_tiles(true);
+        target.clear();
+    }
+    float depthExtent = 0;
+    if (model)
+    {
+        for (int i = 0; i < model->nverts(); i++)
+            depthExtent = std::max(depthExtent, model->vert(i).norm());
+        target.set_depth_range(-depthExtent, depthExtent);
+    }
+    bool subpixel = raster.mode == RasterConfig::FIXED || samples > 1;
+
+    // Out-of-core: the mesh is never resident, triangles come from disk in chunks
+    if (streamBudget > 0)
+    {
+        if (!renderStreamed(modelPath, streamBudget, shading, target, texture, subpixel, light_dir))
+            return 1;
+        TGAImage image;
+        return saveFrame(target, format, image) ? 0 : 1;
+    }
+
+    // Per-frame positions and normals, carved from an arena that is rewound every frame
+    FrameArena arena;
+    Vec3f *verts = NULL;
+    Vec3f *normals = NULL;
+
+    // Submission order of the color and depth passes, front to back with --sort; all faces in
+    // file order otherwise. The pipeline sorts each slot's frame into its own sorter.
+    FaceSorter sorters[2];
+    const int *drawOrder = NULL;
+    int drawCount = 0;
+
+    // Per-face work shared by the full-frame and banded paths.
+    // yOffset is the first screen row covered by target.
+    auto depthFace = [&](int i, RenderTarget &dst, float yOffset)
+    {
+        const std::vector<int> &face = model->face(i);
+        Vec3f v0 = verts[face[0]];
+        Vec3f v1 = verts[face[1]];
+        Vec3f v2 = verts[face[2]];
+        if (((v2 - v0) ^ (v1 - v0)) * view_dir <= 0)
+            return;
+        Vec3f shift(0, yOffset, 0);
+        rasterizeDepth(world2screen(v0, subpixel) - shift, world2screen(v1, subpixel) - shift,
+                       world2screen(v2, subpixel) - shift, dst);
+    };
+
+    auto drawFace = [&](int i, RenderTarget &dst, float yOffset)
     {
         // Indices of vertices in this face
-        std::vector<int> face = model->face(i);
-        std::vector<int> tex_face = model->tex_face(i);
+        const std::vector<int> &face = model->face(i);
+        const std::vector<int> &tex_face = model->tex_face(i);
 
-        Vec3f v0 = model->vert(face[0]);
-        Vec3f v1 = model->vert(face[1]);
-        Vec3f v2 = model->vert(face[2]);
+        Vec3f v0 = verts[face[0]];
+        Vec3f v1 = verts[face[1]];
+        Vec3f v2 = verts[face[2]];
         Vec2f uv0 = model->tex_coord(tex_face[0]);
         Vec2f uv1 = model->tex_coord(tex_face[1]);
         Vec2f uv2 = model->tex_coord(tex_face[2]);
 
         // Face normal for flat shading (backface cull)
         Vec3f normal = ((v2 - v0) ^ (v1 - v0)).normalize();
-        if (normal * light_dir <= 0)
-            continue; // skip back-facing
+        if (normal * view_dir <= 0)
+            return; // skip back-facing
 
         // Flat shading intensity
         float flatIntensity = std::max(0.f, normal * light_dir);
@@ -113,30 +727,488 @@ int main(int argc, char **argv)
             255);
 
         // Gouraud intensities
-        float i0 = std::max(0.f, vertexNormals[face[0]] * light_dir);
-        float i1 = std::max(0.f, vertexNormals[face[1]] * light_dir);
-        float i2 = std::max(0.f, vertexNormals[face[2]] * light_dir);
+        float i0 = std::max(0.f, normals[face[0]] * light_dir);
+        float i1 = std::max(0.f, normals[face[1]] * light_dir);
+        float i2 = std::max(0.f, normals[face[2]] * light_dir);
+
+        // Screen-space coords, relative to the target's first row
+        Vec3f shift(0, yOffset, 0);
+        Vec3f s0 = world2screen(v0, subpixel) - shift;
+        Vec3f s1 = world2screen(v1, subpixel) - shift;
+        Vec3f s2 = world2screen(v2, subpixel) - shift;
+
+        switch (shading)
+        {
+        case FLAT:
+            flatShading(s0, s1, s2, dst, flatColor);
+            break;
+        case GOURAUD:
+            gouraudShading(s0, s1, s2, dst, materialColor, i0, i1, i2);
+            break;
+        case PHONG:
+            if (phongLut > 0)
+                phongShading(s0, s1, s2, dst, materialColor,
+                             normals[face[0]], normals[face[1]], normals[face[2]],
+                             phongTable, shadow);
+            else if (!occlusion.empty())
+            {
+                Vec3f faceOcclusion(occlusion[face[0]], occlusion[face[1]], occlusion[face[2]]);
+                phongShading(s0, s1, s2, dst, materialColor,
+                             normals[face[0]], normals[face[1]], normals[face[2]],
+                             light_dir, shadow, &faceOcclusion);
+            }
+            else
+                phongShading(s0, s1, s2, dst, materialColor,
+                             normals[face[0]], normals[face[1]], normals[face[2]],
+                             light_dir, shadow);
+            break;
+        case TEXTURE:
+            if (compressTexture)
+                addTextures(s0, s1, s2, uv0, uv1, uv2, dst, bc1);
+            else
+                addTextures(s0, s1, s2, uv0, uv1, uv2, dst, texture);
+            break;
+        }
+    };
+
+    // Positions and normals of a frame: the model turned about Y by frame / frames of a turn
+    auto transformFrame = [&](int frame, Vec3f *v, Vec3f *n)
+    {
+        float angle = 2.f * (float)M_PI * frame / frames;
+        for (int k = 0; k < model->nverts(); k++)
+        {
+            v[k] = frames > 1 ? rotateY(model->vert(k), angle) : model->vert(k);
+            n[k] = frames > 1 ? rotateY(vertexNormals[k], angle) : vertexNormals[k];
+        }
+    };
+
+    // Sorts the faces of a frame front to back. The first time, also counts the fragments a color
+    // pass shades in file order and in sorted order on a scratch target, and reports the overdraw.
+    auto sortFrame = [&](int frame, const Vec3f *v, FaceSorter &sorter)
+    {
+        Clock::time_point start = Clock::now();
+        sorter.sort(*model, v, view_dir);
+        if (frame > 0)
+            return;
+        double sortMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::vector<Vec3f> screen(model->nverts());
+        for (int k = 0; k < model->nverts(); k++)
+            screen[k] = world2screen(v[k], subpixel);
+        std::vector<int> fileOrder;
+        for (int i = 0; i < model->nfaces(); i++)
+        {
+            const std::vector<int> &face = model->face(i);
+            if (((v[face[2]] - v[face[0]]) ^ (v[face[1]] - v[face[0]])) * view_dir > 0)
+                fileOrder.push_back(i);
+        }
+        RenderTarget scratch(width, height, layout);
+        uint64_t unsorted = countShadedFragments(*model, screen.data(), fileOrder.data(), (int)fileOrder.size(), scratch);
+        uint64_t sorted = countShadedFragments(*model, screen.data(), sorter.faces(), sorter.size(), scratch);
+        uint64_t covered = 0;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                covered += scratch.depth_row(y)[scratch.column_offset(x)] > -std::numeric_limits<float>::max();
+        std::ostringstream line;
+        line << "front-to-back sort of " << sorter.size() << " faces " << sortMs << " ms; shaded fragments per covered pixel "
+             << (double)unsorted / std::max<uint64_t>(covered, 1) << " in file order, "
+             << (double)sorted / std::max<uint64_t>(covered, 1) << " sorted ("
+             << 100.0 * (1.0 - (double)sorted / std::max<uint64_t>(unsorted, 1)) << "% fewer)\n";
+        std::cerr << line.str();
+    };
 
-        // Screen-space coords
-        Vec3f s0 = world2screen(v0);
-        Vec3f s1 = world2screen(v1);
-        Vec3f s2 = world2screen(v2);
+    // Draws a whole frame from the current verts and normals
+    auto renderFrame = [&](int frame, RenderTarget &dst)
+    {
+        if (frame > 0)
+        {
+            dst.clear();
+            if (shadow)
+                shadow->render(*model, verts);
+        }
+        raster.depthTest = RasterConfig::GREATER;
+        setRasterConfig(raster);
+
+        // Depth-only prepass; the color pass then accepts equal depth and shades each pixel once
+        if (zprepass)
+        {
+            Clock::time_point start = Clock::now();
+            for (int k = 0; k < (drawOrder ? drawCount : model->nfaces()); k++)
+                depthFace(drawOrder ? drawOrder[k] : k, dst, 0);
+            raster.depthTest = RasterConfig::GREATER_EQUAL;
+            setRasterConfig(raster);
+            if (frames == 1)
+                std::cerr << "depth prepass " << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms\n";
+        }
 
-        // Choose which shading to use by uncommenting:
-        // flatShading(s0, s1, s2, image, flatColor, zbuffer);
-        // gouraudShading(s0, s1, s2, image, materialColor, zbuffer, i0, i1, i2);
-        // phongShading(s0, s1, s2, image, materialColor, zbuffer,
-        //               vertexNormals[face[0]], vertexNormals[face[1]], vertexNormals[face[2]],
-        //               light_dir);
-        addTextures(s0, s1, s2, uv0, uv1, uv2, image, texture, zbuffer);
+        // Render loop
+        Clock::time_point colorStart = Clock::now();
+        for (int k = 0; k < (drawOrder ? drawCount : model->nfaces()); k++)
+            drawFace(drawOrder ? drawOrder[k] : k, dst, 0);
+        if (frames == 1)
+            std::cerr << "color pass " << std::chrono::duration<double, std::milli>(Clock::now() - colorStart).count() << " ms\n";
+    };
+
+    if (relights > 0)
+    {
+        verts = arena.alloc<Vec3f>(model->nverts());
+        normals = arena.alloc<Vec3f>(model->nverts());
+        transformFrame(0, verts, normals);
+
+        // Geometry pass: the front faces are rasterized once, into depth and the G-buffer
+        Clock::time_point start = Clock::now();
+        GBuffer gbuffer(width, height);
+        std::vector<int> faceVerts(3 * model->nfaces());
+        std::vector<Vec3f> faceNormals(model->nfaces());
+        for (int i = 0; i < model->nfaces(); i++)
+        {
+            const std::vector<int> &face = model->face(i);
+            const std::vector<int> &tex_face = model->tex_face(i);
+            Vec3f v0 = verts[face[0]];
+            Vec3f v1 = verts[face[1]];
+            Vec3f v2 = verts[face[2]];
+            Vec3f normal = ((v2 - v0) ^ (v1 - v0)).normalize();
+            for (int j = 0; j < 3; j++)
+                faceVerts[3 * i + j] = face[j];
+            faceNormals[i] = normal;
+            if (normal * view_dir <= 0)
+                continue; // skip back-facing
+            gbufferFace(i, world2screen(v0, subpixel), world2screen(v1, subpixel), world2screen(v2, subpixel),
+                        normals[face[0]], normals[face[1]], normals[face[2]],
+                        model->tex_coord(tex_face[0]), model->tex_coord(tex_face[1]), model->tex_coord(tex_face[2]),
+                        target, gbuffer, shading == TEXTURE ? &texture : NULL, materialColor);
+        }
+        std::cerr << "g-buffer pass " << std::chrono::duration<double, std::milli>(Clock::now() - start).count()
+                  << " ms, " << (gbuffer.memory() >> 10) << " KiB\n";
+
+        // Lighting passes: each variant (a light, and with --materials a Phong shininess) is lit in
+        // row bands on all threads, then encoded. Texture shading lights the texture with Phong
+        // intensity. Shininess is spread geometrically over 2.5 .. 40 about the default of 10.
+        RelightMode mode = shading == FLAT ? RELIGHT_FLAT : shading == GOURAUD ? RELIGHT_GOURAUD : RELIGHT_PHONG;
+        RelightMesh mesh = {faceVerts.data(), normals, faceNormals.data(), occlusion.empty() ? NULL : occlusion.data()};
+        const int passRows = 32;
+        const int variants = relights * materials;
+        std::vector<Vec3f> lights;
+        std::vector<PhongParams> params(materials);
+        for (int k = 0; k < relights; k++)
+            lights.push_back(rotateY(light_dir, 2.f * (float)M_PI * k / relights));
+        for (int m = 0; m < materials && materials > 1; m++)
+            params[m].shininess = 10.f * std::pow(4.f, 2.f * m / (materials - 1) - 1.f);
+
+        // Images live in a few slots rather than one per variant: a variant waits for the encode
+        // of the one that last used its slot, so memory stays flat however long the sweep is
+        const int slots = std::min(variants, scheduler.thread_count() + 2);
+        std::vector<TGAImage> images(slots, TGAImage(width, height, TGAImage::RGB));
+        std::vector<TaskScheduler::TaskId> encoded;
+        std::atomic<bool> saveFailed(false);
+        start = Clock::now();
+        for (int v = 0; v < variants; v++)
+        {
+            int light = v / materials, material = v % materials, slot = v % slots;
+            std::vector<TaskScheduler::TaskId> deps, passes;
+            if (v >= slots)
+                deps.push_back(encoded[v - slots]);
+            for (int y0 = 0; y0 < height; y0 += passRows)
+            {
+                passes.push_back(scheduler.add("relight", [&, light, material, slot, y0]()
+                {
+                    relightRows(gbuffer, mesh, mode, lights[light], params[material], NULL,
+                                y0, std::min(height, y0 + passRows), images[slot]);
+                }, deps));
+            }
+            encoded.push_back(scheduler.add("encode", [&, light, material, slot]()
+            {
+                std::string path = "assets/outputs/diablo3_pose_relit_" + std::to_string(light) +
+                                   (materials > 1 ? "_" + std::to_string(material) : std::string()) + ".tga";
+                if (!images[slot].write_tga_file(path.c_str()))
+                    saveFailed = true;
+            }, passes));
+        }
+        scheduler.wait();
+        double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::cerr << variants << " variants (" << relights << " lights x " << materials << " materials) in " << elapsed
+                  << " ms, " << elapsed / variants << " ms per variant, " << slots << " images in flight\n";
+        scheduler.report(std::cerr);
+        if (saveFailed)
+            return 1;
+    }
+    else if (wireframe != NO_WIREFRAME)
+    {
+        verts = arena.alloc<Vec3f>(model->nverts());
+        normals = arena.alloc<Vec3f>(model->nverts());
+        transformFrame(0, verts, normals);
+
+        Clock::time_point start = Clock::now();
+        std::vector<Edge> edges;
+        extractEdges(*model, edges);
+        std::cerr << edges.size() << " unique edges in "
+                  << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms\n";
+
+        // Depth the lines are tested against: the shaded frame, or a depth-only pass
+        if (wireframe == WIREFRAME_OVERLAY)
+        {
+            if (sortFaces)
+            {
+                sortFrame(0, verts, sorters[0]);
+                drawOrder = sorters[0].faces();
+                drawCount = sorters[0].size();
+            }
+            renderFrame(0, target);
+        }
+        else if (wireframe == WIREFRAME_HIDDEN)
+            for (int i = 0; i < model->nfaces(); i++)
+                depthFace(i, target, 0);
+
+        // Lines snap to whole pixels. Every screen region draws the edges binned to it, clipped to
+        // its own rows, so regions run concurrently without sharing a pixel.
+        start = Clock::now();
+        std::vector<Vec3f> screen(model->nverts());
+        for (int k = 0; k < model->nverts(); k++)
+            screen[k] = world2screen(verts[k], false);
+        const int regionRows = 64;
+        int nregions = (height + regionRows - 1) / regionRows;
+        std::vector<int> binStart, binned;
+        binEdges(screen.data(), edges, regionRows, nregions, binStart, binned);
+        bool depthTest = wireframe != WIREFRAME_ALL;
+        for (int r = 0; r < nregions; r++)
+        {
+            scheduler.add("wireframe", [&, r]()
+            {
+                drawEdges(screen.data(), edges.data(), binned.data() + binStart[r], binStart[r + 1] - binStart[r],
+                          target, r * regionRows, std::min(height, (r + 1) * regionRows), white.val, depthTest,
+                          wireframeBias);
+            });
+        }
+        scheduler.wait();
+        std::cerr << "lines in " << nregions << " regions, "
+                  << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms\n";
+
+        TGAImage image;
+        if (!saveFrame(target, format, image))
+            return 1;
+        if (!thumbnailWidths.empty())
+        {
+            if (format != TGA)
+                target.export_tga(image, true);
+            if (!saveThumbnails(image, thumbnailWidths, thumbnailFilter))
+                return 1;
+        }
+    }
+    else if (bandRows > 0)
+    {
+        verts = arena.alloc<Vec3f>(model->nverts());
+        normals = arena.alloc<Vec3f>(model->nverts());
+        transformFrame(0, verts, normals);
+
+        // Sorted faces stay sorted within each band. The overdraw report would need a full-size
+        // target, which is what bands avoid, so it is skipped here.
+        if (sortFaces)
+            sorters[0].sort(*model, verts, view_dir);
+
+        // Bin front faces by the bands their screen-space rows touch (CSR: counts, then fill)
+        int nbands = (height + bandRows - 1) / bandRows;
+        std::vector<int> binStart(nbands + 1, 0);
+        std::vector<int> binFaces;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            std::vector<int> fill(binStart.begin(), binStart.end() - 1);
+            for (int k = 0; k < (sortFaces ? sorters[0].size() : model->nfaces()); k++)
+            {
+                int i = sortFaces ? sorters[0].faces()[k] : k;
+                const std::vector<int> &face = model->face(i);
+                Vec3f v0 = model->vert(face[0]);
+                Vec3f v1 = model->vert(face[1]);
+                Vec3f v2 = model->vert(face[2]);
+                if (((v2 - v0) ^ (v1 - v0)) * view_dir <= 0)
+                    continue;
+                float y0 = world2screen(v0, subpixel).y, y1 = world2screen(v1, subpixel).y, y2 = world2screen(v2, subpixel).y;
+                int first = std::max(0, (int)std::floor(std::min({y0, y1, y2})) / bandRows);
+                int last = std::min(nbands - 1, (int)std::ceil(std::max({y0, y1, y2})) / bandRows);
+                for (int b = first; b <= last; b++)
+                {
+                    if (pass == 0)
+                        binStart[b + 1]++;
+                    else
+                        binFaces[fill[b]++] = i;
+                }
+            }
+            if (pass == 0)
+            {
+                for (int b = 0; b < nbands; b++)
+                    binStart[b + 1] += binStart[b];
+                binFaces.resize(binStart[nbands]);
+            }
+        }
+
+        // Render each band and append it to the file, bottom band first
+        TGAStreamWriter writer;
+        if (!writer.open("assets/outputs/diablo3_pose_output.tga", width, height, TGAImage::RGB))
+            return 1;
+        TGAImage bandImage;
+        Clock::time_point start = Clock::now();
+        for (int b = 0; b < nbands; b++)
+        {
+            int y0 = b * bandRows;
+            target.clear();
+            if (shadow)
+                shadow->setScreenOffset(y0);
+            if (zprepass)
+            {
+                raster.depthTest = RasterConfig::GREATER;
+                setRasterConfig(raster);
+                for (int k = binStart[b]; k < binStart[b + 1]; k++)
+                    depthFace(binFaces[k], target, y0);
+                raster.depthTest = RasterConfig::GREATER_EQUAL;
+                setRasterConfig(raster);
+            }
+            for (int k = binStart[b]; k < binStart[b + 1]; k++)
+                drawFace(binFaces[k], target, y0);
+            target.export_tga(bandImage, false);
+            if (!writer.write_rows(ImageView(bandImage).crop(0, 0, width, height - y0)))
+                return 1;
+        }
+        if (!writer.close())
+            return 1;
+        std::cerr << nbands << " bands of " << bandRows << " rows, " << binFaces.size() << " binned faces, "
+                  << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms\n";
+    }
+    else if (pipeline)
+    {
+        // Consecutive frames overlap: frame N + 1 is transformed while frame N rasterizes and frame
+        // N - 1 encodes. Vertex buffers and targets alternate between two slots; the dependencies
+        // keep a slot from being refilled before the stage reading it has finished. Rasterization
+        // shares the raster config and shadow map, and encoding the TGA staging image, so each
+        // stage also runs its frames in order. Every frame is written to its own file.
+        RenderTarget *targets[2] = {&target, new RenderTarget(width, height, layout, samples, RenderTarget::COLOR_DEPTH, depthFormat)};
+        targets[1]->set_depth_range(-depthExtent, depthExtent);
+        if (depthTiles)
+        {
+            targets[1]->set_depth_tiles(true);
+            targets[1]->clear();
+        }
+        std::vector<Vec3f> slotVerts[2], slotNormals[2];
+        for (int slot = 0; slot < 2; slot++)
+        {
+            slotVerts[slot].resize(model->nverts());
+            slotNormals[slot].resize(model->nverts());
+        }
+        TGAImage image;
+        std::atomic<bool> saveFailed(false);
+        std::vector<TaskScheduler::TaskId> transformed, rendered, encoded;
+        Clock::time_point start = Clock::now();
+        for (int frame = 0; frame < frames; frame++)
+        {
+            int slot = frame & 1;
+            std::vector<TaskScheduler::TaskId> deps;
+            if (frame >= 2)
+                deps.push_back(rendered[frame - 2]);
+            transformed.push_back(scheduler.add("transform", [&, frame, slot]()
+            {
+                transformFrame(frame, slotVerts[slot].data(), slotNormals[slot].data());
+                if (sortFaces)
+                    sortFrame(frame, slotVerts[slot].data(), sorters[slot]);
+            }, deps));
+
+            deps.assign(1, transformed[frame]);
+            if (frame >= 1)
+                deps.push_back(rendered[frame - 1]);
+            if (frame >= 2)
+                deps.push_back(encoded[frame - 2]);
+            rendered.push_back(scheduler.add("raster", [&, frame, slot]()
+            {
+                verts = slotVerts[slot].data();
+                normals = slotNormals[slot].data();
+                if (sortFaces)
+                {
+                    drawOrder = sorters[slot].faces();
+                    drawCount = sorters[slot].size();
+                }
+                renderFrame(frame, *targets[slot]);
+            }, deps));
+
+            deps.assign(1, rendered[frame]);
+            if (frame >= 1)
+                deps.push_back(encoded[frame - 1]);
+            encoded.push_back(scheduler.add("encode", [&, frame, slot]()
+            {
+                if (!saveFrame(*targets[slot], format, image, frame))
+                    saveFailed = true;
+            }, deps));
+        }
+        scheduler.wait();
+        double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::cerr << frames << " pipelined frames in " << elapsed << " ms, " << elapsed / frames << " ms per frame\n";
+        scheduler.report(std::cerr);
+
+        bool ok = !saveFailed;
+        RenderTarget &last = *targets[(frames - 1) & 1];
+        if (ok && !thumbnailWidths.empty())
+        {
+            if (format != TGA)
+                last.export_tga(image, true);
+            ok = saveThumbnails(image, thumbnailWidths, thumbnailFilter);
+        }
+        delete targets[1];
+        if (!ok)
+            return 1;
     }
+    else
+    {
+        // Frame loop. After the first frames have sized the arena, a frame makes no heap allocations.
+        TGAImage image;
+        size_t frameAllocations = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            Clock::time_point frameStart = Clock::now();
+            size_t allocationsBefore = heapAllocations();
+            arena.reset();
 
-    // Save final image
-    image.flip_vertically();
-    image.write_tga_file("assets/outputs/diablo3_pose_output.tga");
+            verts = arena.alloc<Vec3f>(model->nverts());
+            normals = arena.alloc<Vec3f>(model->nverts());
+            transformFrame(frame, verts, normals);
+            if (sortFaces)
+            {
+                sortFrame(frame, verts, sorters[0]);
+                drawOrder = sorters[0].faces();
+                drawCount = sorters[0].size();
+            }
+            renderFrame(frame, target);
+
+            size_t allocations = heapAllocations() - allocationsBefore;
+            if (frame >= 2)
+            {
+                // Steady state: the arena and every buffer are warm
+                assert(allocations == 0);
+                frameAllocations += allocations;
+            }
+            if (frames > 1)
+                std::cerr << "frame " << frame << " " << std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count()
+                          << " ms, " << allocations << " allocations\n";
+        }
+        if (frames > 1)
+            std::cerr << "arena " << (arena.capacity() >> 10) << " KiB, peak " << (arena.peak_usage() >> 10)
+                      << " KiB, " << frameAllocations << " steady-state allocations\n";
+        if (const DepthTiles *tiles = target.depth_tiles())
+            std::cerr << "depth tiles: " << tiles->tile_count(DepthTiles::TILE_PLANE) << " planes, "
+                      << tiles->tile_count(DepthTiles::TILE_CLEAR) << " clear, " << tiles->rejected_count()
+                      << " triangle-tile pairs rejected\n";
+
+        // Save the last frame
+        Clock::time_point saveStart = Clock::now();
+        if (!saveFrame(target, format, image))
+            return 1;
+        std::cerr << "saved " << outputExtensions[format] << " in "
+                  << std::chrono::duration<double, std::milli>(Clock::now() - saveStart).count() << " ms\n";
+        if (!thumbnailWidths.empty())
+        {
+            if (format != TGA)
+                target.export_tga(image, true);
+            if (!saveThumbnails(image, thumbnailWidths, thumbnailFilter))
+                return 1;
+        }
+    }
 
     // Cleanup
+    delete shadow;
     delete model;
-    delete[] zbuffer;
     return 0;
 }
@@ -0,0 +1,235 @@
+// meshstream.cpp
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include "meshstream.h"
+
+namespace fs = std::filesystem;
+
+struct MeshCacheHeader
+{
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t nverts, nuvs, nfaces;
+};
+
+static const char cacheMagic[8] = {'T', 'R', 'M', 'E', 'S', 'H', '0', '1'};
+
+static bool appendFile(std::ofstream &out, const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return false;
+    std::vector<char> buf(1 << 20);
+    while (in)
+    {
+        in.read(buf.data(), buf.size());
+        out.write(buf.data(), in.gcount());
+    }
+    return out.good();
+}
+
+// OBJ index to 0-based: positive indices count from 1, negative ones back from the last of
+// the n elements read so far. 0 is not a valid index.
+static bool resolveIndex(long index, uint64_t n, int32_t &out)
+{
+    if (index == 0 || (index < 0 && (uint64_t)-index > n))
+        return false;
+    out = (int32_t)(index > 0 ? index - 1 : (long)n + index);
+    return true;
+}
+
+// Parses "v", "v/t", "v//n" or "v/t/n" into 0-based vertex and uv indices (uv -1 if absent),
+// given the vertex and uv counts so far; fails on a missing or invalid vertex or uv index
+static bool parseCorner(const std::string &token, uint64_t nverts, uint64_t nuvs, int32_t &v, int32_t &t)
+{
+    const char *p = token.c_str();
+    char *end;
+    long index = std::strtol(p, &end, 10);
+    if (end == p || !resolveIndex(index, nverts, v))
+        return false;
+    t = -1;
+    if (*end == '/' && end[1] != '/')
+    {
+        const char *q = end + 1;
+        index = std::strtol(q, &end, 10);
+        if (end != q && !resolveIndex(index, nuvs, t))
+            return false;
+    }
+    return true;
+}
+
+MeshStream::MeshStream() : nverts_(0), nuvs_(0), nfaces_(0), nextFace(0), facesOffset(0), chunkFaces(0)
+{
+}
+
+bool MeshStream::buildCache(const char *objPath)
+{
+    std::ifstream obj(objPath);
+    if (!obj)
+        return false;
+    std::string vtmp = cachePath + ".v.tmp", ttmp = cachePath + ".t.tmp", ftmp = cachePath + ".f.tmp";
+    std::ofstream vout(vtmp, std::ios::binary), tout(ttmp, std::ios::binary), fout(ftmp, std::ios::binary);
+    MeshCacheHeader header;
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.sourceSize = fs::file_size(objPath);
+    header.sourceTime = fs::last_write_time(objPath).time_since_epoch().count();
+    header.nverts = header.nuvs = header.nfaces = 0;
+
+    std::string line, token;
+    std::vector<int32_t> corners;
+    bool ok = true;
+    while (std::getline(obj, line))
+    {
+        if (!line.compare(0, 2, "v "))
+        {
+            Vec3f v;
+            std::sscanf(line.c_str() + 2, "%f %f %f", &v.x, &v.y, &v.z);
+            vout.write((const char *)&v, sizeof(v));
+            header.nverts++;
+        }
+        else if (!line.compare(0, 3, "vt "))
+        {
+            Vec2f uv;
+            std::sscanf(line.c_str() + 3, "%f %f", &uv.x, &uv.y);
+            tout.write((const char *)&uv, sizeof(uv));
+            header.nuvs++;
+        }
+        else if (!line.compare(0, 2, "f "))
+        {
+            std::istringstream iss(line.substr(2));
+            corners.clear();
+            int32_t v, t;
+            while (iss >> token)
+            {
+                if (!parseCorner(token, header.nverts, header.nuvs, v, t))
+                {
+                    std::cerr << objPath << ": bad face corner \"" << token << "\"\n";
+                    ok = false;
+                    break;
+                }
+                corners.push_back(v);
+                corners.push_back(t);
+            }
+            if (!ok)
+                break;
+            // Triangle fan, stored as v0 v1 v2 t0 t1 t2
+            for (size_t k = 2; k < corners.size() / 2; k++)
+            {
+                int32_t tri[6] = {corners[0], corners[2 * (k - 1)], corners[2 * k],
+                                  corners[1], corners[2 * (k - 1) + 1], corners[2 * k + 1]};
+                fout.write((const char *)tri, sizeof(tri));
+                header.nfaces++;
+            }
+        }
+    }
+    vout.close();
+    tout.close();
+    fout.close();
+    if (ok && (vout.fail() || tout.fail() || fout.fail()))
+    {
+        std::cerr << "can't write the temporary files of " << cachePath << "\n";
+        ok = false;
+    }
+
+    if (ok)
+    {
+        std::ofstream out(cachePath, std::ios::binary);
+        out.write((const char *)&header, sizeof(header));
+        ok = out.good() && appendFile(out, vtmp) && appendFile(out, ttmp) && appendFile(out, ftmp);
+        out.close();
+        ok = ok && !out.fail();
+        if (!ok)
+        {
+            std::cerr << "can't write " << cachePath << "\n";
+            std::remove(cachePath.c_str());
+        }
+    }
+    std::remove(vtmp.c_str());
+    std::remove(ttmp.c_str());
+    std::remove(ftmp.c_str());
+    return ok;
+}
+
+bool MeshStream::open(const char *objPath, size_t budgetBytes)
+{
+    cachePath = std::string(objPath) + ".mesh";
+    MeshCacheHeader header;
+    bool fresh = false;
+    for (int attempt = 0; attempt < 2 && !fresh; attempt++)
+    {
+        in.close();
+        in.clear();
+        in.open(cachePath, std::ios::binary);
+        if (in.read((char *)&header, sizeof(header)) && !memcmp(header.magic, cacheMagic, sizeof(cacheMagic)))
+        {
+            std::error_code ec;
+            fresh = !fs::exists(objPath, ec) ||
+                    (header.sourceSize == fs::file_size(objPath, ec) &&
+                     header.sourceTime == fs::last_write_time(objPath, ec).time_since_epoch().count());
+        }
+        if (!fresh && attempt == 0)
+        {
+            in.close();
+            std::cerr << "building mesh cache " << cachePath << "\n";
+            if (!buildCache(objPath))
+            {
+                std::cerr << "can't build mesh cache for " << objPath << "\n";
+                return false;
+            }
+        }
+    }
+    if (!fresh)
+        return false;
+
+    nverts_ = header.nverts;
+    nuvs_ = header.nuvs;
+    nfaces_ = header.nfaces;
+    nextFace = 0;
+    std::streamoff vertsOffset = sizeof(header);
+    std::streamoff uvsOffset = vertsOffset + (std::streamoff)(nverts_ * sizeof(Vec3f));
+    facesOffset = uvsOffset + (std::streamoff)(nuvs_ * sizeof(Vec2f));
+
+    // A quarter of the budget for the triangle chunk, half for vertices, a quarter for uvs
+    const size_t perFace = 6 * sizeof(int32_t) + sizeof(StreamTriangle);
+    chunkFaces = (int)std::max<size_t>(64, budgetBytes / 4 / perFace);
+    indices.assign((size_t)chunkFaces * 6, 0);
+    const int pageVerts = 4096;
+    verts.init(&in, vertsOffset, nverts_, pageVerts,
+               (int)std::max<size_t>(1, budgetBytes / 2 / (pageVerts * sizeof(Vec3f))));
+    uvs.init(&in, uvsOffset, nuvs_, pageVerts,
+             (int)std::max<size_t>(1, budgetBytes / 4 / (pageVerts * sizeof(Vec2f))));
+    std::cerr << "# streaming v# " << nverts_ << " f# " << nfaces_ << " in chunks of " << chunkFaces << "\n";
+    return true;
+}
+
+int MeshStream::next(std::vector<StreamTriangle> &chunk)
+{
+    int n = (int)std::min<uint64_t>(chunkFaces, nfaces_ - nextFace);
+    chunk.resize(n);
+    if (n == 0)
+        return 0;
+    in.clear();
+    in.seekg(facesOffset + (std::streamoff)(nextFace * 6 * sizeof(int32_t)));
+    in.read((char *)indices.data(), (std::streamsize)n * 6 * sizeof(int32_t));
+    nextFace += n;
+    for (int i = 0; i < n; i++)
+    {
+        const int32_t *f = &indices[(size_t)i * 6];
+        for (int j = 0; j < 3; j++)
+        {
+            chunk[i].v[j] = (f[j] >= 0 && (uint64_t)f[j] < nverts_) ? verts.get(f[j]) : Vec3f();
+            chunk[i].uv[j] = (f[3 + j] >= 0 && (uint64_t)f[3 + j] < nuvs_) ? uvs.get(f[3 + j]) : Vec2f();
+        }
+    }
+    return n;
+}
+
+size_t MeshStream::memory() const
+{
+    return indices.size() * sizeof(int32_t) + (size_t)chunkFaces * sizeof(StreamTriangle) +
+           verts.memory() + uvs.memory();
+}
@@ -51,7 +51,9 @@ Model::Model(const char *filename) : verts_(), tex_coords_(), faces_(), tex_indi
             tex_indices_.push_back(tf);
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << std::endl;
+    std::ostringstream summary;
+    summary << "# v# " << verts_.size() << " f# " << faces_.size() << "\n";
+    std::cerr << summary.str();
 }
 
 Model::~Model()
@@ -64,7 +66,7 @@ int Model::nverts()
 }
 Vec2f Model::tex_coord(int i) { return tex_coords_[i]; }
 
-std::vector<int> Model::tex_face(int idx)
+const std::vector<int> &Model::tex_face(int idx)
 {
     return tex_indices_[idx];
 }
@@ -73,7 +75,7 @@ int Model::nfaces()
     return (int)faces_.size();
 }
 
-std::vector<int> Model::face(int idx)
+const std::vector<int> &Model::face(int idx)
 {
     return faces_[idx];
 }
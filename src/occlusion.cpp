@@ -0,0 +1,119 @@
+// occlusion.cpp
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "occlusion.h"
+
+namespace fs = std::filesystem;
+
+struct OcclusionHeader
+{
+    char magic[8];
+    int32_t nverts;
+    int32_t rays;
+    float radius;
+};
+
+static const char occlusionMagic[8] = {'T', 'R', 'A', 'O', '0', '0', '0', '1'};
+
+static float fract(float x)
+{
+    return x - std::floor(x);
+}
+
+void bakeOcclusion(const BVH &bvh, Model &model, const Vec3f *normals, float extent,
+                   const OcclusionParams &params, int first, int last, float *visibility)
+{
+    const int N = RayPacket::SIZE;
+    RayPacket packet;
+    packet.tmax = params.radius * extent;
+    for (int v = first; v < last; v++)
+    {
+        // The renderer's winding makes normals point into the model: rays go the other way
+        Vec3f n = normals[v] * -1.f;
+        if (n * n == 0 || params.rays <= 0)
+        {
+            visibility[v] = 1.f;
+            continue;
+        }
+
+        // Tangent frame about the normal; the origin is lifted off the surface
+        Vec3f axis = std::fabs(n.x) > 0.9f ? Vec3f(0, 1, 0) : Vec3f(1, 0, 0);
+        Vec3f t = (axis ^ n).normalize();
+        Vec3f b = n ^ t;
+        packet.origin = model.vert(v) + n * (1e-3f * extent);
+
+        // Stratified in cos^2 of the polar angle, golden-ratio steps in azimuth, turned by a
+        // per-vertex offset so that neighbouring vertices don't share the same pattern
+        float turn = fract(v * 0.7548777f);
+        int escaped = 0;
+        for (int j = 0; j < params.rays; j += N)
+        {
+            int lanes = std::min(N, params.rays - j);
+            for (int i = 0; i < N; i++)
+            {
+                int k = j + std::min(i, lanes - 1);
+                float u = (k + 0.5f) / params.rays;
+                float phi = 2.f * (float)M_PI * fract(k * 0.618034f + turn);
+                float r = std::sqrt(u);
+                Vec3f d = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(1.f - u);
+                packet.dx[i] = d.x;
+                packet.dy[i] = d.y;
+                packet.dz[i] = d.z;
+            }
+            unsigned blocked = bvh.occluded(packet) & ((1u << lanes) - 1);
+            escaped += lanes - (int)std::bitset<RayPacket::SIZE>(blocked).count();
+        }
+        visibility[v] = (float)escaped / params.rays;
+    }
+}
+
+bool readOcclusionCache(const char *modelPath, int nverts, const OcclusionParams &params,
+                        std::vector<float> &visibility)
+{
+    std::string cachePath = std::string(modelPath) + ".ao";
+    std::error_code ec;
+    if (!fs::exists(cachePath, ec) || fs::last_write_time(cachePath, ec) < fs::last_write_time(modelPath, ec))
+        return false;
+    std::ifstream in(cachePath, std::ios::binary);
+    OcclusionHeader header;
+    if (!in.read((char *)&header, sizeof(header)) || memcmp(header.magic, occlusionMagic, sizeof(occlusionMagic)) ||
+        header.nverts != nverts || header.rays != params.rays || header.radius != params.radius)
+        return false;
+    visibility.resize(nverts);
+    return (bool)in.read((char *)visibility.data(), visibility.size() * sizeof(float));
+}
+
+bool writeOcclusionCache(const char *modelPath, const OcclusionParams &params,
+                         const std::vector<float> &visibility)
+{
+    std::string cachePath = std::string(modelPath) + ".ao";
+    std::ofstream out(cachePath, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "can't open file " + cachePath + "\n";
+        return false;
+    }
+    OcclusionHeader header;
+    memcpy(header.magic, occlusionMagic, sizeof(occlusionMagic));
+    header.nverts = (int32_t)visibility.size();
+    header.rays = params.rays;
+    header.radius = params.radius;
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)visibility.data(), visibility.size() * sizeof(float));
+    out.close();
+    if (out.fail())
+    {
+        // Don't leave a truncated cache behind for the next run
+        std::remove(cachePath.c_str());
+        std::cerr << "can't write " + cachePath + "\n";
+        return false;
+    }
+    return true;
+}
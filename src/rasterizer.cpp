@@ -0,0 +1,24 @@
+// rasterizer.cpp
+#include "rasterizer.h"
+#include "cpudispatch.h"
+
+static RasterConfig currentConfig;
+
+void setRasterConfig(const RasterConfig &config)
+{
+    currentConfig = config;
+}
+
+const RasterConfig &rasterConfig()
+{
+    return currentConfig;
+}
+
+static inline void rasterizeDepthImpl(const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, RenderTarget &target)
+{
+    rasterize(t0, t1, t2, target, DepthOnly());
+}
+
+DISPATCH_KERNEL(void, rasterizeDepth, rasterizeDepthImpl,
+                (const Vec3f &t0, const Vec3f &t1, const Vec3f &t2, RenderTarget &target),
+                (t0, t1, t2, target))
@@ -0,0 +1,272 @@
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <vector>
+#include "rendertarget.h"
+#include "cpudispatch.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(KERNEL_DISPATCH_X86)
+#include <immintrin.h>
+#endif
+
+static const int ALIGNMENT = 64;
+
+static void *alignedAlloc(size_t nbytes)
+{
+    nbytes = (nbytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    return std::aligned_alloc(ALIGNMENT, nbytes);
+}
+
+// Stores value count times; dst is 64-byte aligned and count a multiple of 16
+static void fill32Generic(void *dst, uint32_t value, int count)
+{
+#if defined(__SSE2__)
+    const __m128i v = _mm_set1_epi32((int)value);
+    __m128i *p = (__m128i *)dst;
+    for (int i = 0; i < count / 4; i += 4)
+    {
+        _mm_store_si128(p + i, v);
+        _mm_store_si128(p + i + 1, v);
+        _mm_store_si128(p + i + 2, v);
+        _mm_store_si128(p + i + 3, v);
+    }
+#else
+    uint32_t *p = (uint32_t *)dst;
+    for (int i = 0; i < count; i++)
+        p[i] = value;
+#endif
+}
+
+#if defined(KERNEL_DISPATCH_X86)
+// Two 32-byte stores per 64-byte line
+KERNEL_AVX2 static void fill32Avx2(void *dst, uint32_t value, int count)
+{
+    const __m256i v = _mm256_set1_epi32((int)value);
+    __m256i *p = (__m256i *)dst;
+    for (int i = 0; i < count / 8; i += 2)
+    {
+        _mm256_store_si256(p + i, v);
+        _mm256_store_si256(p + i + 1, v);
+    }
+}
+#endif
+
+static void fill32(void *dst, uint32_t value, int count)
+{
+#if defined(KERNEL_DISPATCH_X86)
+    static void (*const kernel)(void *, uint32_t, int) = selectKernel(fill32Generic, fill32Generic, fill32Avx2);
+    kernel(dst, value, count);
+#else
+    fill32Generic(dst, value, count);
+#endif
+}
+
+static size_t depthElementSize(RenderTarget::DepthFormat format)
+{
+    return format == RenderTarget::DEPTH_U16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+RenderTarget::RenderTarget(int w, int h, Layout l, int nsamples, Buffers buffers, DepthFormat depth)
+    : colors(NULL), depths(NULL), width(w), height(h), pitch(0), npixels(0), samples(nsamples), layout(l),
+      depthFormat(depth), zmin(-1), depthScale(0), depthMax(0)
+{
+    // Pad rows to a whole number of 64-byte lines (16 pixels), tiles to whole tiles
+    int pw = (width + 15) & ~15;
+    int ph = height;
+    if (layout == TILED)
+        ph = (height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+    pitch = pw;
+    npixels = pw * ph * samples;
+    if (buffers == COLOR_DEPTH)
+        colors = (uint32_t *)alignedAlloc(npixels * sizeof(uint32_t));
+    depths = alignedAlloc(depth_bytes());
+    depthMax = depthFormat == DEPTH_U24 ? 0xffffff : (depthFormat == DEPTH_U16 ? 0xffff : 0);
+    set_depth_range(-1, 1);
+    clear();
+}
+
+RenderTarget::~RenderTarget()
+{
+    std::free(colors);
+    std::free(depths);
+}
+
+void RenderTarget::clear()
+{
+    clear(0, -std::numeric_limits<float>::max());
+}
+
+void RenderTarget::set_depth_range(float zNear, float zFar)
+{
+    zmin = zNear;
+    depthScale = zFar > zNear && depthMax > 0 ? (float)(depthMax - 1) / (zFar - zNear) : 0.f;
+}
+
+size_t RenderTarget::depth_bytes() const
+{
+    return (size_t)npixels * depthElementSize(depthFormat);
+}
+
+float RenderTarget::depth_at(int x, int y) const
+{
+    if (depthFormat == DEPTH_F32)
+        return ((const float *)depths)[offset(x, y)];
+    uint32_t v;
+    const DepthTiles::Tile *t = tiles.enabled() ? &tiles.tile(x / TILE_SIZE, y / TILE_SIZE) : NULL;
+    if (t && t->mode == DepthTiles::TILE_CLEAR)
+        v = tiles.clear_value();
+    else if (t && t->mode == DepthTiles::TILE_PLANE)
+        v = encode_depth(t->plane.at(t->plane.row((float)y), (float)x));
+    else if (depthFormat == DEPTH_U24)
+        v = ((const uint32_t *)depths)[offset(x, y)];
+    else
+        v = ((const uint16_t *)depths)[offset(x, y)];
+    if (v == 0)
+        return -std::numeric_limits<float>::max();
+    return zmin + (v - 1) / depthScale;
+}
+
+void RenderTarget::set_depth_tiles(bool enabled)
+{
+    if (enabled == tiles.enabled())
+        return;
+    if (!enabled)
+    {
+        flush_depth_tiles();
+        tiles.resize(0, 0, 0);
+    }
+    else if (depthFormat != DEPTH_F32 && samples == 1)
+        tiles.resize(width, height, depthMax);
+}
+
+void RenderTarget::materialize_depth_tile(int tx, int ty)
+{
+    DepthTiles::Tile &t = tiles.tile(tx, ty);
+    if (t.mode == DepthTiles::TILE_ROWS)
+        return;
+    const int x0 = tx * TILE_SIZE, x1 = std::min(width, x0 + TILE_SIZE);
+    const int y0 = ty * TILE_SIZE, y1 = std::min(height, y0 + TILE_SIZE);
+    // A tile's row is contiguous in either layout
+    for (int y = y0; y < y1; y++)
+    {
+        uint32_t *row24 = depth_row_u24(y) + column_offset(x0);
+        uint16_t *row16 = depth_row_u16(y) + column_offset(x0);
+        if (t.mode == DepthTiles::TILE_CLEAR)
+        {
+            if (depthFormat == DEPTH_U16)
+                std::fill(row16, row16 + (x1 - x0), (uint16_t)tiles.clear_value());
+            else
+                std::fill(row24, row24 + (x1 - x0), tiles.clear_value());
+            continue;
+        }
+        // Same evaluation order as the float rasterizers, so the expanded plane is bit-identical
+        const float rowZ = t.plane.row((float)y);
+        for (int x = x0; x < x1; x++)
+        {
+            uint32_t v = encode_depth(t.plane.at(rowZ, (float)x));
+            if (depthFormat == DEPTH_U16)
+                row16[x - x0] = (uint16_t)v;
+            else
+                row24[x - x0] = v;
+        }
+    }
+    t.mode = DepthTiles::TILE_ROWS;
+}
+
+void RenderTarget::flush_depth_tiles()
+{
+    for (int ty = 0; ty < tiles.tiles_y(); ty++)
+        for (int tx = 0; tx < tiles.tiles_x(); tx++)
+            materialize_depth_tile(tx, ty);
+}
+
+void RenderTarget::clear(uint32_t color, float depth)
+{
+    uint32_t depthBits;
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+    if (colors)
+        fill32(colors, color, npixels);
+    if (depthFormat == DEPTH_F32)
+    {
+        fill32(depths, depthBits, npixels);
+        return;
+    }
+    depthBits = depth < zmin ? 0 : encode_depth(depth);
+    if (tiles.enabled())
+    {
+        tiles.clear(depthBits);
+        return;
+    }
+    if (depthFormat == DEPTH_U16)
+    {
+        // Two depths per word; a row holds a multiple of 16 pixels, so npixels / 2 is a multiple of 8
+        // and the allocation, rounded up to 64 bytes, covers the rounded-up count
+        fill32(depths, depthBits | depthBits << 16, (npixels / 2 + 15) & ~15);
+        return;
+    }
+    fill32(depths, depthBits, npixels);
+}
+
+void RenderTarget::export_tga(TGAImage &image, bool flip_vertically) const
+{
+    if (image.get_width() != width || image.get_height() != height ||
+        (image.get_bytespp() != TGAImage::RGB && image.get_bytespp() != TGAImage::RGBA))
+    {
+        image = TGAImage(width, height, TGAImage::RGB);
+    }
+    int bpp = image.get_bytespp();
+    unsigned char *out = image.buffer();
+    std::vector<uint32_t> tmp(layout == LINEAR && samples == 1 ? 0 : width);
+    for (int y = 0; y < height; y++)
+    {
+        const uint32_t *src = resolve_colors(flip_vertically ? height - 1 - y : y, tmp.data());
+        unsigned char *dst = out + (unsigned long)y * width * bpp;
+        if (bpp == TGAImage::RGBA)
+        {
+            memcpy(dst, src, width * sizeof(uint32_t));
+            continue;
+        }
+        for (int x = 0; x < width; x++, dst += bpp)
+        {
+            dst[0] = src[x] & 0xff;
+            dst[1] = (src[x] >> 8) & 0xff;
+            dst[2] = (src[x] >> 16) & 0xff;
+        }
+    }
+}
+
+const uint32_t *RenderTarget::resolve_colors(int y, uint32_t *tmp) const
+{
+    const uint32_t *src = colors + row_offset(y);
+    if (layout == LINEAR && samples == 1)
+        return src;
+    for (int x = 0; x < width; x++)
+        tmp[x] = averageColors(src + column_offset(x), samples);
+    return tmp;
+}
+
+const float *RenderTarget::resolve_depths(int y, float *tmp) const
+{
+    if (depthFormat != DEPTH_F32)
+    {
+        for (int x = 0; x < width; x++)
+            tmp[x] = depth_at(x, y);
+        return tmp;
+    }
+    const float *src = depth_row(y);
+    if (layout == LINEAR && samples == 1)
+        return src;
+    for (int x = 0; x < width; x++)
+    {
+        const float *z = src + column_offset(x);
+        float nearest = z[0];
+        for (int s = 1; s < samples; s++)
+            nearest = std::max(nearest, z[s]);
+        tmp[x] = nearest;
+    }
+    return tmp;
+}
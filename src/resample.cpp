@@ -0,0 +1,223 @@
+// resample.cpp
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include "resample.h"
+#include "cpudispatch.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static float filterSupport(ResampleFilter filter)
+{
+    switch (filter)
+    {
+    case BOX:
+        return 0.5f;
+    case BILINEAR:
+        return 1.f;
+    case LANCZOS3:
+        return 3.f;
+    }
+    return 1.f;
+}
+
+static float filterValue(ResampleFilter filter, float x)
+{
+    switch (filter)
+    {
+    case BOX:
+        return x >= -0.5f && x < 0.5f ? 1.f : 0.f;
+    case BILINEAR:
+        return std::max(0.f, 1.f - std::fabs(x));
+    case LANCZOS3:
+        if (x == 0.f)
+            return 1.f;
+        if (std::fabs(x) >= 3.f)
+            return 0.f;
+        {
+            float px = (float)M_PI * x;
+            return 3.f * std::sin(px) * std::sin(px / 3.f) / (px * px);
+        }
+    }
+    return 0.f;
+}
+
+// Normalized taps of every output sample along one axis.
+// Output i reads source samples start[i] .. start[i] + taps - 1, all inside the source.
+struct FilterWeights
+{
+    int taps;
+    std::vector<int> start;
+    std::vector<float> weights; // taps per output sample
+};
+
+static void computeWeights(int srcSize, int dstSize, ResampleFilter filter, FilterWeights &fw)
+{
+    float scale = (float)dstSize / srcSize;
+    float filterScale = std::min(1.f, scale); // downscaling widens the filter to cover the footprint
+    float support = filterSupport(filter) / filterScale;
+    fw.taps = std::min(srcSize, (int)std::ceil(2 * support) + 1);
+    fw.start.resize(dstSize);
+    fw.weights.assign((size_t)dstSize * fw.taps, 0.f);
+    for (int i = 0; i < dstSize; i++)
+    {
+        float center = (i + 0.5f) / scale;
+        int left = (int)std::floor(center - support);
+        int start = std::max(0, std::min(left, srcSize - fw.taps));
+        float *w = &fw.weights[(size_t)i * fw.taps];
+        float sum = 0;
+        for (int k = 0; k < fw.taps; k++)
+        {
+            w[k] = filterValue(filter, (start + k + 0.5f - center) * filterScale);
+            sum += w[k];
+        }
+        if (sum == 0.f)
+        {
+            // Can only happen at the edges of a tiny source: take the nearest sample
+            int nearest = std::max(0, std::min(srcSize - 1, (int)center)) - start;
+            w[std::max(0, std::min(fw.taps - 1, nearest))] = 1.f;
+            sum = 1.f;
+        }
+        for (int k = 0; k < fw.taps; k++)
+            w[k] /= sum;
+        fw.start[i] = start;
+    }
+}
+
+// Runs fn(first, last) over [0, n) in chunks of rows, on up to `threads` threads
+template <class F>
+static void parallelRows(int n, int threads, F fn)
+{
+    const int chunk = 16;
+    std::atomic<int> next(0);
+    auto worker = [&]()
+    {
+        for (int first = next.fetch_add(chunk); first < n; first = next.fetch_add(chunk))
+            fn(first, std::min(n, first + chunk));
+    };
+    threads = std::max(1, std::min(threads, (n + chunk - 1) / chunk));
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool)
+        t.join();
+}
+
+// dst[0..3] = sum of w[k] * src[(k * stride)..+3], four channels at a time
+static inline void weightedSum(const float *src, int stride, const float *w, int taps, float *dst)
+{
+#if defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < taps; k++, src += stride)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(src)));
+    _mm_storeu_ps(dst, acc);
+#else
+    float acc[4] = {0, 0, 0, 0};
+    for (int k = 0; k < taps; k++, src += stride)
+        for (int c = 0; c < 4; c++)
+            acc[c] += w[k] * src[c];
+    for (int c = 0; c < 4; c++)
+        dst[c] = acc[c];
+#endif
+}
+
+// acc[0..n) += w * row[0..n). Plain loop, vectorized by the compiler for each ISA level.
+static inline void accumulateRowImpl(const float *row, float w, float *acc, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        acc[i] += w * row[i];
+}
+
+// One source row (4 floats per pixel) filtered horizontally into dstW output pixels
+static inline void filterRowImpl(const float *line, const FilterWeights &fw, int dstW, float *out)
+{
+    for (int x = 0; x < dstW; x++)
+        weightedSum(line + fw.start[x] * 4, 4, &fw.weights[(size_t)x * fw.taps], fw.taps, out + x * 4);
+}
+
+static void accumulateRow(const float *row, float w, float *acc, size_t n);
+static void filterRow(const float *line, const FilterWeights &fw, int dstW, float *out);
+
+DISPATCH_KERNEL(void, accumulateRow, accumulateRowImpl,
+                (const float *row, float w, float *acc, size_t n), (row, w, acc, n))
+DISPATCH_KERNEL(void, filterRow, filterRowImpl,
+                (const float *line, const FilterWeights &fw, int dstW, float *out), (line, fw, dstW, out))
+
+bool resample(const ImageView &src, std::vector<TGAImage> &dsts, ResampleFilter filter, int threads)
+{
+    int bpp = src.get_bytespp();
+    int srcW = src.get_width();
+    int srcH = src.get_height();
+    if (srcW <= 0 || srcH <= 0)
+        return false;
+    for (TGAImage &dst : dsts)
+    {
+        if (dst.get_bytespp() != bpp || dst.get_width() <= 0 || dst.get_height() <= 0)
+        {
+            std::cerr << "resample: destination must be allocated with " << bpp << " bytes per pixel\n";
+            return false;
+        }
+    }
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t ndst = dsts.size();
+    std::vector<FilterWeights> hw(ndst), vw(ndst);
+    std::vector<std::vector<float>> rows(ndst); // horizontal pass output, dst width x src height
+    for (size_t d = 0; d < ndst; d++)
+    {
+        computeWeights(srcW, dsts[d].get_width(), filter, hw[d]);
+        computeWeights(srcH, dsts[d].get_height(), filter, vw[d]);
+        rows[d].resize((size_t)dsts[d].get_width() * srcH * 4);
+    }
+
+    // Horizontal: each source row is widened to 4 floats per pixel once, then filtered into every output
+    parallelRows(srcH, threads, [&](int first, int last)
+    {
+        std::vector<float> line((size_t)srcW * 4, 0.f);
+        for (int y = first; y < last; y++)
+        {
+            for (int x = 0; x < srcW; x++)
+            {
+                const unsigned char *p = src.pixel(x, y);
+                for (int c = 0; c < bpp; c++)
+                    line[x * 4 + c] = p[c];
+            }
+            for (size_t d = 0; d < ndst; d++)
+            {
+                int dstW = dsts[d].get_width();
+                filterRow(line.data(), hw[d], dstW, &rows[d][(size_t)y * dstW * 4]);
+            }
+        }
+    });
+
+    // Vertical: each output row is a weighted sum of whole horizontally filtered rows
+    for (size_t d = 0; d < ndst; d++)
+    {
+        const FilterWeights &fw = vw[d];
+        int dstW = dsts[d].get_width();
+        size_t stride = (size_t)dstW * 4;
+        unsigned char *out = dsts[d].buffer();
+        parallelRows(dsts[d].get_height(), threads, [&](int first, int last)
+        {
+            std::vector<float> acc(stride);
+            for (int y = first; y < last; y++)
+            {
+                const float *w = &fw.weights[(size_t)y * fw.taps];
+                std::fill(acc.begin(), acc.end(), 0.f);
+                for (int k = 0; k < fw.taps; k++)
+                    accumulateRow(&rows[d][(fw.start[y] + k) * stride], w[k], acc.data(), stride);
+                unsigned char *o = out + (size_t)y * dstW * bpp;
+                for (int x = 0; x < dstW; x++, o += bpp)
+                    for (int c = 0; c < bpp; c++)
+                        o[c] = (unsigned char)std::min(255.f, std::max(0.f, acc[x * 4 + c] + 0.5f));
+            }
+        });
+    }
+    return true;
+}
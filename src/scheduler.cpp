@@ -0,0 +1,198 @@
+// scheduler.cpp
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include "scheduler.h"
+
+TaskScheduler::TaskScheduler(int threads) : queued(0), unfinished(0), stopping(false)
+{
+    if (threads <= 0)
+        threads = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+    for (int i = 0; i <= threads; i++)
+        queues.emplace_back(new Queue());
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(&TaskScheduler::workerLoop, this, i);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(wakeLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+int TaskScheduler::stageIndex(const char *stage)
+{
+    for (size_t i = 0; i < stages.size(); i++)
+        if (stages[i].name == stage)
+            return (int)i;
+    StageStats s = {stage, 0, 0, 0, 0, 0};
+    stages.push_back(s);
+    return (int)stages.size() - 1;
+}
+
+void TaskScheduler::push(Task *task, int queue)
+{
+    task->readyAt = Clock::now();
+    {
+        std::lock_guard<std::mutex> guard(queues[queue]->lock);
+        queues[queue]->tasks.push_back(task);
+    }
+    int depth = ++queued;
+    {
+        std::lock_guard<std::mutex> guard(graphLock);
+        StageStats &s = stages[task->stage];
+        s.maxDepth = std::max(s.maxDepth, depth);
+    }
+    {
+        // Empty critical section: a thread about to sleep either sees the new count or gets the notify
+        std::lock_guard<std::mutex> guard(wakeLock);
+    }
+    wake.notify_all();
+}
+
+TaskScheduler::Task *TaskScheduler::pop(int queue)
+{
+    // Own queue first, newest task
+    {
+        Queue &own = *queues[queue];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            Task *task = own.tasks.back();
+            own.tasks.pop_back();
+            queued--;
+            return task;
+        }
+    }
+    // Then steal the oldest task of another queue
+    int n = (int)queues.size();
+    for (int k = 1; k < n; k++)
+    {
+        Queue &other = *queues[(queue + k) % n];
+        std::lock_guard<std::mutex> guard(other.lock);
+        if (!other.tasks.empty())
+        {
+            Task *task = other.tasks.front();
+            other.tasks.pop_front();
+            queued--;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+void TaskScheduler::run(Task *task, int queue)
+{
+    Clock::time_point start = Clock::now();
+    task->fn();
+    Clock::time_point end = Clock::now();
+
+    std::vector<Task *> ready;
+    {
+        std::lock_guard<std::mutex> guard(graphLock);
+        StageStats &s = stages[task->stage];
+        double queuedMs = std::chrono::duration<double, std::milli>(start - task->readyAt).count();
+        s.tasks++;
+        s.queuedMs += queuedMs;
+        s.maxQueuedMs = std::max(s.maxQueuedMs, queuedMs);
+        s.runMs += std::chrono::duration<double, std::milli>(end - start).count();
+        task->done = true;
+        for (Task *next : task->successors)
+            if (--next->pending == 0)
+                ready.push_back(next);
+    }
+    for (Task *next : ready)
+        push(next, queue);
+    if (--unfinished == 0)
+    {
+        std::lock_guard<std::mutex> guard(wakeLock);
+        wake.notify_all();
+    }
+}
+
+void TaskScheduler::workerLoop(int queue)
+{
+    for (;;)
+    {
+        Task *task = pop(queue);
+        if (task)
+        {
+            run(task, queue);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(wakeLock);
+        wake.wait(guard, [&]() { return stopping || queued > 0; });
+        if (stopping)
+            return;
+    }
+}
+
+TaskScheduler::TaskId TaskScheduler::add(const char *stage, std::function<void()> fn, const std::vector<TaskId> &deps)
+{
+    Task *task = new Task();
+    task->fn = std::move(fn);
+    task->pending = 0;
+    task->done = false;
+    unfinished++; // before any dependency can finish and release the task
+    TaskId id;
+    bool ready;
+    {
+        std::lock_guard<std::mutex> guard(graphLock);
+        task->stage = stageIndex(stage);
+        for (TaskId dep : deps)
+        {
+            Task *before = graph[dep].get();
+            if (!before->done)
+            {
+                before->successors.push_back(task);
+                task->pending++;
+            }
+        }
+        id = (TaskId)graph.size();
+        graph.emplace_back(task);
+        ready = task->pending == 0;
+    }
+    if (ready)
+        push(task, (int)queues.size() - 1);
+    return id;
+}
+
+void TaskScheduler::wait()
+{
+    int shared = (int)queues.size() - 1;
+    while (unfinished > 0)
+    {
+        Task *task = pop(shared);
+        if (task)
+        {
+            run(task, shared);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(wakeLock);
+        wake.wait(guard, [&]() { return unfinished == 0 || queued > 0; });
+    }
+    std::lock_guard<std::mutex> guard(graphLock);
+    graph.clear();
+}
+
+void TaskScheduler::report(std::ostream &out) const
+{
+    // Formatted locally so the caller's stream keeps its flags and precision
+    std::ostringstream table;
+    table << "stage            tasks   run ms  queued ms (mean/max)  max depth\n" << std::fixed << std::setprecision(2);
+    for (const StageStats &s : stages)
+    {
+        table << std::left << std::setw(16) << s.name << std::right << std::setw(6) << s.tasks
+              << std::setw(9) << s.runMs
+              << std::setw(11) << (s.tasks ? s.queuedMs / s.tasks : 0.0) << " /" << std::setw(8) << s.maxQueuedMs
+              << std::setw(11) << s.maxDepth << "\n";
+    }
+    out << table.str();
+}
@@ -0,0 +1,59 @@
+// shadow.cpp
+#include <algorithm>
+#include <cmath>
+#include "shadow.h"
+#include "rasterizer.h"
+
+ShadowMap::ShadowMap(int s, const Vec3f &lightDir, float e, int sw, int sh)
+    : depth(s, s, RenderTarget::LINEAR, 1, RenderTarget::DEPTH_ONLY), size(s),
+      extent(e), bias(0), pcfRadius(0), screenWidth(sw), screenHeight(sh), screenOffset(0)
+{
+    forward = (lightDir * -1.f).normalize();
+    Vec3f hint = std::fabs(forward.y) > 0.99f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+    right = (hint ^ forward).normalize();
+    up = forward ^ right;
+    // Two texels of slack against self-shadowing acne
+    bias = 2.f * (2.f * extent / size);
+}
+
+Vec3f ShadowMap::toLight(const Vec3f &v) const
+{
+    return Vec3f((v * right / extent + 1.f) * size / 2.f,
+                 (v * up / extent + 1.f) * size / 2.f,
+                 v * forward);
+}
+
+void ShadowMap::render(Model &model, const Vec3f *verts)
+{
+    depth.clear();
+    for (int i = 0; i < model.nfaces(); i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        Vec3f v0 = verts ? verts[face[0]] : model.vert(face[0]);
+        Vec3f v1 = verts ? verts[face[1]] : model.vert(face[1]);
+        Vec3f v2 = verts ? verts[face[2]] : model.vert(face[2]);
+        rasterizeDepth(toLight(v0), toLight(v1), toLight(v2), depth);
+    }
+}
+
+float ShadowMap::visibility(const Vec3f &screen) const
+{
+    // Undo world2screen() of the camera pass
+    Vec3f v(screen.x * 2.f / screenWidth - 1.f, (screen.y + screenOffset) * 2.f / screenHeight - 1.f, screen.z);
+    Vec3f l = toLight(v);
+    int cx = (int)std::floor(l.x), cy = (int)std::floor(l.y);
+    int lit = 0, taps = 0;
+    for (int y = cy - pcfRadius; y <= cy + pcfRadius; y++)
+    {
+        for (int x = cx - pcfRadius; x <= cx + pcfRadius; x++)
+        {
+            taps++;
+            // Outside the map nothing casts a shadow
+            if (x < 0 || y < 0 || x >= size || y >= size)
+                lit++;
+            else if (l.z + bias >= depth.depth_row(y)[depth.column_offset(x)])
+                lit++;
+        }
+    }
+    return (float)lit / taps;
+}
@@ -6,9 +6,19 @@
 #include <time.h>
 #include <math.h>
 #include <map>
+#include <string>
+#include <algorithm>
+#include <vector>
 #include "tgaimage.h"
+#include "imageview.h"
+#include "resample.h"
+#include "cpudispatch.h"
 #include "geometry.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 const TGAColor materialColor = TGAColor(139, 69, 19, 255);
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0)
@@ -63,7 +73,7 @@ bool TGAImage::read_tga_file(const char *filename)
     in.open(filename, std::ios::binary);
     if (!in.is_open())
     {
-        std::cerr << "can't open file " << filename << "\n";
+        std::cerr << "can't open file " + std::string(filename) + "\n";
         in.close();
         return false;
     }
@@ -108,7 +118,7 @@ bool TGAImage::read_tga_file(const char *filename)
     else
     {
         in.close();
-        std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+        std::cerr << "unknown file format " + std::to_string((int)header.datatypecode) + "\n";
         return false;
     }
     if (!(header.imagedescriptor & 0x20))
@@ -119,7 +129,8 @@ bool TGAImage::read_tga_file(const char *filename)
     {
         flip_horizontally();
     }
-    std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
+    // One write, as textures load on scheduler threads next to other assets
+    std::cerr << std::to_string(width) + "x" + std::to_string(height) + "/" + std::to_string(bytespp * 8) + "\n";
     in.close();
     return true;
 }
@@ -257,25 +268,24 @@ bool TGAImage::write_tga_file(const char *filename, bool rle)
 }
 
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out)
+// Encodes RLE packets of data[curpix..npixels) into out while a worst-case packet still fits
+// in capacity bytes. Returns the bytes written and advances curpix past the pixels encoded.
+static inline size_t encode_rle_impl(const unsigned char *data, unsigned long npixels, int bytespp,
+                                     unsigned long &curpix, unsigned char *out, size_t capacity)
 {
     const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width * height;
-    unsigned long curpix = 0;
-    while (curpix < npixels)
+    size_t packet_max = 1 + max_chunk_length * bytespp;
+    size_t n = 0;
+    while (curpix < npixels && n + packet_max <= capacity)
     {
-        unsigned long chunkstart = curpix * bytespp;
-        unsigned long curbyte = curpix * bytespp;
+        const unsigned char *chunk = data + curpix * bytespp;
+        const unsigned char *p = chunk;
         unsigned char run_length = 1;
         bool raw = true;
         while (curpix + run_length < npixels && run_length < max_chunk_length)
         {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bytespp; t++)
-            {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-            }
-            curbyte += bytespp;
+            bool succ_eq = memcmp(p, p + bytespp, bytespp) == 0;
+            p += bytespp;
             if (1 == run_length)
             {
                 raw = !succ_eq;
@@ -292,13 +302,31 @@ bool TGAImage::unload_rle_data(std::ofstream &out)
             run_length++;
         }
         curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good())
-        {
-            std::cerr << "can't dump the tga file\n";
-            return false;
-        }
-        out.write((char *)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+        out[n++] = raw ? run_length - 1 : run_length + 127;
+        size_t bytes = raw ? run_length * bytespp : bytespp;
+        memcpy(out + n, chunk, bytes);
+        n += bytes;
+    }
+    return n;
+}
+
+static size_t encode_rle(const unsigned char *data, unsigned long npixels, int bytespp,
+                         unsigned long &curpix, unsigned char *out, size_t capacity);
+
+DISPATCH_KERNEL(size_t, encode_rle, encode_rle_impl,
+                (const unsigned char *data, unsigned long npixels, int bytespp, unsigned long &curpix,
+                 unsigned char *out, size_t capacity),
+                (data, npixels, bytespp, curpix, out, capacity))
+
+static bool write_rle(std::ofstream &out, const unsigned char *data, unsigned long npixels, int bytespp)
+{
+    // Packets are staged in a buffer and written in blocks rather than one stream call each
+    unsigned char buffer[16384];
+    unsigned long curpix = 0;
+    while (curpix < npixels)
+    {
+        size_t n = encode_rle(data, npixels, bytespp, curpix, buffer, sizeof(buffer));
+        out.write((char *)buffer, n);
         if (!out.good())
         {
             std::cerr << "can't dump the tga file\n";
@@ -308,6 +336,11 @@ bool TGAImage::unload_rle_data(std::ofstream &out)
     return true;
 }
 
+bool TGAImage::unload_rle_data(std::ofstream &out)
+{
+    return write_rle(out, data, width * height, bytespp);
+}
+
 TGAColor TGAImage::get(int x, int y)
 {
     if (!data || x < 0 || y < 0 || x >= width || y >= height)
@@ -346,15 +379,29 @@ bool TGAImage::flip_horizontally()
 {
     if (!data)
         return false;
-    int half = width >> 1;
-    for (int i = 0; i < half; i++)
+    unsigned long bytes_per_line = width * bytespp;
+    for (int j = 0; j < height; j++)
     {
-        for (int j = 0; j < height; j++)
+        unsigned char *line = data + j * bytes_per_line;
+        int l = 0, r = width - 1;
+#if defined(__SSE2__)
+        if (bytespp == 4)
         {
-            TGAColor c1 = get(i, j);
-            TGAColor c2 = get(width - 1 - i, j);
-            set(i, j, c2);
-            set(width - 1 - i, j, c1);
+            // Four pixels from each end, reversed with one shuffle and swapped
+            for (; r - l >= 7; l += 4, r -= 4)
+            {
+                __m128i a = _mm_loadu_si128((__m128i *)(line + l * 4));
+                __m128i b = _mm_loadu_si128((__m128i *)(line + (r - 3) * 4));
+                _mm_storeu_si128((__m128i *)(line + l * 4), _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3)));
+                _mm_storeu_si128((__m128i *)(line + (r - 3) * 4), _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 1, 2, 3)));
+            }
+        }
+#endif
+        for (; l < r; l++, r--)
+        {
+            unsigned char *p1 = line + l * bytespp;
+            unsigned char *p2 = line + r * bytespp;
+            std::swap_ranges(p1, p1 + bytespp, p2);
         }
     }
     return true;
@@ -365,17 +412,14 @@ bool TGAImage::flip_vertically()
     if (!data)
         return false;
     unsigned long bytes_per_line = width * bytespp;
-    unsigned char *line = new unsigned char[bytes_per_line];
     int half = height >> 1;
     for (int j = 0; j < half; j++)
     {
-        unsigned long l1 = j * bytes_per_line;
-        unsigned long l2 = (height - 1 - j) * bytes_per_line;
-        memmove((void *)line, (void *)(data + l1), bytes_per_line);
-        memmove((void *)(data + l1), (void *)(data + l2), bytes_per_line);
-        memmove((void *)(data + l2), (void *)line, bytes_per_line);
+        // Swap in place, no temporary line
+        unsigned char *l1 = data + j * bytes_per_line;
+        unsigned char *l2 = data + (height - 1 - j) * bytes_per_line;
+        std::swap_ranges(l1, l1 + bytes_per_line, l2);
     }
-    delete[] line;
     return true;
 }
 
@@ -393,40 +437,11 @@ bool TGAImage::scale(int w, int h)
 {
     if (w <= 0 || h <= 0 || !data)
         return false;
-    unsigned char *tdata = new unsigned char[w * h * bytespp];
-    int nscanline = 0;
-    int oscanline = 0;
-    int erry = 0;
-    unsigned long nlinebytes = w * bytespp;
-    unsigned long olinebytes = width * bytespp;
-    for (int j = 0; j < height; j++)
-    {
-        int errx = width - w;
-        int nx = -bytespp;
-        int ox = -bytespp;
-        for (int i = 0; i < width; i++)
-        {
-            ox += bytespp;
-            errx += w;
-            while (errx >= (int)width)
-            {
-                errx -= width;
-                nx += bytespp;
-                memcpy(tdata + nscanline + nx, data + oscanline + ox, bytespp);
-            }
-        }
-        erry += h;
-        oscanline += olinebytes;
-        while (erry >= (int)height)
-        {
-            if (erry >= (int)height << 1) // it means we jump over a scanline
-                memcpy(tdata + nscanline + nlinebytes, tdata + nscanline, nlinebytes);
-            erry -= height;
-            nscanline += nlinebytes;
-        }
-    }
-    delete[] data;
-    data = tdata;
+    // Filtered resize instead of nearest-neighbour, so thumbnails don't alias
+    std::vector<TGAImage> scaled(1, TGAImage(w, h, bytespp));
+    if (!resample(ImageView(*this), scaled, BILINEAR))
+        return false;
+    std::swap(data, scaled[0].data);
     width = w;
     height = h;
     return true;
@@ -440,3 +455,96 @@ TGAColor generateRandomColor(std::mt19937 &gen)
     unsigned char b = dis(gen);                  // Random blue
     return TGAColor(r, g, b, 255);               // Fully opaque
 }
+
+TGAStreamWriter::TGAStreamWriter() : width(0), height(0), bytespp(0), rows(0), rle(true)
+{
+}
+
+bool TGAStreamWriter::open(const char *filename, int w, int h, int bpp, bool compress)
+{
+    width = w;
+    height = h;
+    bytespp = bpp;
+    rows = 0;
+    rle = compress;
+    // The header stores both dimensions in 16 bits
+    if (width <= 0 || height <= 0 || width > 65535 || height > 65535)
+    {
+        std::cerr << "tga can't hold a " << width << "x" << height << " image\n";
+        return false;
+    }
+    out.open(filename, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    TGA_Header header;
+    memset((void *)&header, 0, sizeof(header));
+    header.bitsperpixel = bytespp << 3;
+    header.width = width;
+    header.height = height;
+    header.datatypecode = (bytespp == TGAImage::GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
+    header.imagedescriptor = 0x00; // bottom-left origin, rows arrive bottom-up
+    out.write((char *)&header, sizeof(header));
+    if (!out.good())
+    {
+        std::cerr << "can't dump the tga file\n";
+        return false;
+    }
+    return true;
+}
+
+bool TGAStreamWriter::write_rows(const unsigned char *data, int nrows)
+{
+    nrows = std::min(nrows, height - rows);
+    unsigned long linebytes = (unsigned long)width * bytespp;
+    for (int j = 0; j < nrows; j++)
+    {
+        const unsigned char *line = data + j * linebytes;
+        bool ok = rle ? write_rle(out, line, width, bytespp) : out.write((const char *)line, linebytes).good();
+        if (!ok)
+        {
+            std::cerr << "can't dump the tga file\n";
+            return false;
+        }
+    }
+    rows += nrows;
+    return true;
+}
+
+bool TGAStreamWriter::write_rows(const ImageView &view)
+{
+    if (view.get_width() != width || view.get_bytespp() != bytespp)
+    {
+        std::cerr << "tga stream got a " << view.get_width() << "x" << view.get_bytespp() * 8 << " view\n";
+        return false;
+    }
+    for (int j = 0; j < view.get_height(); j++)
+    {
+        if (!write_rows(view.row(j), 1))
+            return false;
+    }
+    return true;
+}
+
+bool TGAStreamWriter::close()
+{
+    unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+    unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+    unsigned char footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+    if (rows != height)
+    {
+        std::cerr << "tga stream closed after " << rows << " of " << height << " rows\n";
+        out.close();
+        return false;
+    }
+    out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+    out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+    out.write((char *)footer, sizeof(footer));
+    out.close();
+    bool ok = !out.fail();
+    if (!ok)
+        std::cerr << "can't dump the tga file\n";
+    return ok;
+}
@@ -0,0 +1,154 @@
+// wireframe.cpp
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "wireframe.h"
+#include "cpudispatch.h"
+
+void extractEdges(Model &model, std::vector<Edge> &edges)
+{
+    // Each edge as a 64-bit key, smaller vertex in the high half; sorting brings duplicates together
+    std::vector<uint64_t> keys;
+    keys.reserve((size_t)model.nfaces() * 3);
+    for (int i = 0; i < model.nfaces(); i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        int n = (int)face.size();
+        for (int j = 0; j < n; j++)
+        {
+            uint32_t a = (uint32_t)face[j], b = (uint32_t)face[(j + 1) % n];
+            if (a == b)
+                continue;
+            keys.push_back(a < b ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a));
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    edges.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        edges[i].a = (int)(keys[i] >> 32);
+        edges[i].b = (int)(keys[i] & 0xffffffffu);
+    }
+}
+
+static inline int toPixel(float v)
+{
+    return (int)std::floor(v + 0.5f);
+}
+
+void binEdges(const Vec3f *screen, const std::vector<Edge> &edges, int bandRows, int nbands,
+              std::vector<int> &binStart, std::vector<int> &binEdges)
+{
+    // Counts, then offsets, then fill
+    binStart.assign(nbands + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::vector<int> fill(binStart.begin(), binStart.end() - 1);
+        for (size_t i = 0; i < edges.size(); i++)
+        {
+            int ya = toPixel(screen[edges[i].a].y), yb = toPixel(screen[edges[i].b].y);
+            int first = std::max(0, std::min(ya, yb));
+            int last = std::min(nbands * bandRows - 1, std::max(ya, yb));
+            for (int b = first / bandRows; first <= last && b <= last / bandRows; b++)
+            {
+                if (pass == 0)
+                    binStart[b + 1]++;
+                else
+                    binEdges[fill[b]++] = (int)i;
+            }
+        }
+        if (pass == 0)
+        {
+            for (int b = 0; b < nbands; b++)
+                binStart[b + 1] += binStart[b];
+            binEdges.resize(binStart[nbands]);
+        }
+    }
+}
+
+// Ceiling of a / b for b > 0
+static inline int64_t ceilDiv(int64_t a, int64_t b)
+{
+    return a >= 0 ? (a + b - 1) / b : -(-a / b);
+}
+
+// Bresenham's line in closed form: at step i along the major axis the minor axis has moved
+// (2 * i * minor + major) / (2 * major) pixels, so a band can start in the middle of a line
+// with the same pixels a full walk would produce.
+static inline void drawLine(const Vec3f &p0, const Vec3f &p1, RenderTarget &target, int y0, int y1,
+                            uint32_t color, bool depthTest, float bias)
+{
+    int ax = toPixel(p0.x), ay = toPixel(p0.y);
+    int bx = toPixel(p1.x), by = toPixel(p1.y);
+    int adx = std::abs(bx - ax), ady = std::abs(by - ay);
+    int sx = bx < ax ? -1 : 1, sy = by < ay ? -1 : 1;
+    bool yMajor = ady >= adx;
+    int major = std::max(adx, ady), minor = std::min(adx, ady);
+
+    // The band as row offsets (y - ay) * sy along the line
+    int dLo = sy > 0 ? y0 - ay : ay - (y1 - 1);
+    int dHi = sy > 0 ? y1 - 1 - ay : ay - y0;
+    dLo = std::max(dLo, 0);
+    dHi = std::min(dHi, ady);
+    if (dLo > dHi)
+        return;
+
+    // Steps whose row lies in the band
+    int first, last;
+    if (yMajor)
+    {
+        first = dLo;
+        last = dHi;
+    }
+    else if (ady == 0)
+    {
+        first = 0;
+        last = adx;
+    }
+    else
+    {
+        first = dLo == 0 ? 0 : (int)ceilDiv((int64_t)(2 * dLo - 1) * adx, 2 * ady);
+        last = std::min(adx, (int)ceilDiv((int64_t)(2 * dHi + 1) * adx, 2 * ady) - 1);
+    }
+
+    const int width = target.get_width();
+    const int64_t twoMajor = 2 * (int64_t)std::max(major, 1);
+    int64_t n = 2 * (int64_t)first * minor + major;
+    int q = (int)(n / twoMajor);
+    int64_t r = n % twoMajor;
+    float dz = major > 0 ? (p1.z - p0.z) / major : 0.f;
+    const bool f32 = target.get_depth_format() == RenderTarget::DEPTH_F32;
+    for (int i = first; i <= last; i++)
+    {
+        int x = yMajor ? ax + sx * q : ax + sx * i;
+        int y = yMajor ? ay + sy * i : ay + sy * q;
+        if ((unsigned)x < (unsigned)width)
+        {
+            int idx = target.column_offset(x);
+            if (!depthTest || p0.z + dz * i + bias >= (f32 ? target.depth_row(y)[idx] : target.depth_at(x, y)))
+                target.color_row(y)[idx] = color;
+        }
+        r += 2 * minor;
+        if (r >= twoMajor)
+        {
+            r -= twoMajor;
+            q++;
+        }
+    }
+}
+
+static inline void drawEdgesImpl(const Vec3f *screen, const Edge *edges, const int *indices, int count,
+                                 RenderTarget &target, int y0, int y1, uint32_t color, bool depthTest, float bias)
+{
+    for (int k = 0; k < count; k++)
+    {
+        const Edge &e = edges[indices[k]];
+        drawLine(screen[e.a], screen[e.b], target, y0, y1, color, depthTest, bias);
+    }
+}
+
+DISPATCH_KERNEL(void, drawEdges, drawEdgesImpl,
+                (const Vec3f *screen, const Edge *edges, const int *indices, int count, RenderTarget &target,
+                 int y0, int y1, uint32_t color, bool depthTest, float bias),
+                (screen, edges, indices, count, target, y0, y1, color, depthTest, bias))
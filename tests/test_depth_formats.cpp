@@ -0,0 +1,184 @@
+// test_depth_formats.cpp
+// The integer depth formats against float depth on the bundled models, with and without depth tiles
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "model.h"
+#include "rendertarget.h"
+#include "rasterizer.h"
+
+static const int size = 800;
+
+// Front faces in file order as main.cpp's world2screen() maps them, three vertices each, and
+// the index of each face
+static void screenFaces(Model &model, bool subpixel, std::vector<Vec3f> &tris, std::vector<int> &faces)
+{
+    const Vec3f viewDir(0, 0, -1);
+    tris.clear();
+    faces.clear();
+    for (int i = 0; i < model.nfaces(); i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        Vec3f v[3];
+        for (int j = 0; j < 3; j++)
+        {
+            Vec3f p = model.vert(face[j]);
+            v[j] = subpixel ? Vec3f((p.x + 1.f) * size / 2.f, (p.y + 1.f) * size / 2.f, p.z)
+                            : Vec3f(int((p.x + 1.f) * size / 2.f + 0.5f), int((p.y + 1.f) * size / 2.f + 0.5f), p.z);
+        }
+        if (((v[2] - v[0]) ^ (v[1] - v[0])) * viewDir <= 0)
+            continue;
+        tris.insert(tris.end(), v, v + 3);
+        faces.push_back(i);
+    }
+}
+
+// Face index + 1 as the color, after a depth-only pass and with the color pass at
+// GREATER_EQUAL if prepass is set. depth receives the float depth of the face each pixel
+// keeps, computed as the rasterizer does: from the float path's depth plane, or from the
+// fixed-point path's barycentric weights.
+static void drawFaceIds(const std::vector<Vec3f> &tris, const std::vector<int> &faces, bool prepass,
+                        RenderTarget &target, std::vector<float> &depth)
+{
+    const RasterConfig config = rasterConfig();
+    const bool subpixel = config.mode == RasterConfig::FIXED;
+    depth.assign((size_t)size * size, 0.f);
+    target.clear();
+    if (prepass)
+    {
+        for (size_t k = 0; k < tris.size(); k += 3)
+            rasterizeDepth(tris[k], tris[k + 1], tris[k + 2], target);
+        RasterConfig equal = config;
+        equal.depthTest = RasterConfig::GREATER_EQUAL;
+        setRasterConfig(equal);
+    }
+    for (size_t k = 0; k < tris.size(); k += 3)
+    {
+        const Vec3f &s0 = tris[k], &s1 = tris[k + 1], &s2 = tris[k + 2];
+        FloatDepthPlane plane;
+        plane.setup(s0, s1, s2, barycentricArea(s0, s1, s2));
+        const uint32_t id = (uint32_t)faces[k / 3] + 1;
+        rasterize(s0, s1, s2, target, [&, id](const Vec3f &bc, int x, int y)
+        {
+            depth[(size_t)y * size + x] = subpixel ? s0.z * bc.x + s1.z * bc.y + s2.z * bc.z
+                                                   : plane.at(plane.row((float)y), (float)x);
+            return id;
+        });
+    }
+    setRasterConfig(config);
+}
+
+static int differingColors(RenderTarget &a, RenderTarget &b)
+{
+    int differing = 0;
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            differing += a.color_row(y)[x] != b.color_row(y)[x];
+    return differing;
+}
+
+// Depths as read through the tiles, then the rows once the tiles are written out
+static bool sameDepth(RenderTarget &a, RenderTarget &b)
+{
+    std::vector<float> za(size), zb(size);
+    for (int y = 0; y < size; y++)
+        if (memcmp(a.resolve_depths(y, za.data()), b.resolve_depths(y, zb.data()), size * sizeof(float)) != 0)
+            return false;
+    a.flush_depth_tiles();
+    b.flush_depth_tiles();
+    return memcmp(a.depth_row(0), b.depth_row(0), a.depth_bytes()) == 0;
+}
+
+int main()
+{
+    const char *models[] = {"assets/models/african_head.obj", "assets/models/diablo3_pose.obj", "assets/models/body.obj"};
+    int failures = 0;
+    for (const char *path : models)
+    {
+        Model model(path);
+        if (model.nfaces() == 0)
+            return 1;
+        float extent = 0;
+        for (int i = 0; i < model.nverts(); i++)
+            extent = std::max(extent, model.vert(i).norm());
+
+        for (bool subpixel : {false, true})
+        {
+            RasterConfig config;
+            if (subpixel)
+                config.mode = RasterConfig::FIXED;
+            setRasterConfig(config);
+            std::vector<Vec3f> tris;
+            std::vector<int> faces;
+            screenFaces(model, subpixel, tris, faces);
+            RenderTarget reference(size, size);
+            std::vector<float> referenceDepth;
+            drawFaceIds(tris, faces, false, reference, referenceDepth);
+
+            for (RenderTarget::DepthFormat format : {RenderTarget::DEPTH_U24, RenderTarget::DEPTH_U16})
+            {
+                const std::string name = std::string(path) + (subpixel ? ", fixed, " : ", float, ") +
+                                         (format == RenderTarget::DEPTH_U24 ? "u24" : "u16");
+                RenderTarget compact(size, size, RenderTarget::LINEAR, 1, RenderTarget::COLOR_DEPTH, format);
+                compact.set_depth_range(-extent, extent);
+                std::vector<float> compactDepth;
+                drawFaceIds(tris, faces, false, compact, compactDepth);
+
+                // Quantizing keeps the depth order but can make close depths equal, and the face
+                // drawn first then stays: a face may differ from the float buffer's only by such a
+                // tie, within one depth step plus the float rounding of the encode, which at 24 bits
+                // is about another step. The float rasterizer covers shared edges from both faces,
+                // so it has such ties; the fixed-point one owns every pixel of an edge once, and on
+                // these models it keeps exactly the float buffer's faces in both formats.
+                const float tolerance = 2.f / compact.get_depth_scale();
+                int changed = 0, hidden = 0;
+                for (int y = 0; y < size; y++)
+                {
+                    for (int x = 0; x < size; x++)
+                    {
+                        if (reference.color_row(y)[x] == compact.color_row(y)[x])
+                            continue;
+                        changed++;
+                        hidden += reference.depth_row(y)[x] - compactDepth[(size_t)y * size + x] > tolerance;
+                    }
+                }
+                if (hidden > 0 || (subpixel && changed > 0))
+                {
+                    std::cerr << name << ": visible face differs at " << changed << " pixels, " << hidden
+                              << " by more than two depth steps\n";
+                    failures++;
+                }
+
+                // Depth tiles change how depth is stored, not what is visible: the same colors and
+                // depths as the rows alone, with and without a z-prepass
+                for (bool prepass : {false, true})
+                {
+                    RenderTarget rows(size, size, RenderTarget::LINEAR, 1, RenderTarget::COLOR_DEPTH, format);
+                    RenderTarget tiled(size, size, RenderTarget::LINEAR, 1, RenderTarget::COLOR_DEPTH, format);
+                    tiled.set_depth_tiles(true);
+                    rows.set_depth_range(-extent, extent);
+                    tiled.set_depth_range(-extent, extent);
+                    std::vector<float> rowsDepth, tiledDepth;
+                    drawFaceIds(tris, faces, prepass, rows, rowsDepth);
+                    drawFaceIds(tris, faces, prepass, tiled, tiledDepth);
+                    const DepthTiles *tiles = tiled.depth_tiles();
+                    if (!tiles || (!subpixel && tiles->tile_count(DepthTiles::TILE_PLANE) == 0))
+                    {
+                        std::cerr << name << (prepass ? ", prepass" : "") << ": no depth tiles stored as planes\n";
+                        failures++;
+                    }
+                    int differing = differingColors(rows, tiled);
+                    if (differing > 0 || !sameDepth(rows, tiled))
+                    {
+                        std::cerr << name << (prepass ? ", prepass" : "") << ": depth tiles change " << differing
+                                  << " colors or the depth\n";
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+// test_depth_only.cpp
+// The depth-only rasterizer against the depth a color pass writes, for both coverage modes and every depth format
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "model.h"
+#include "rendertarget.h"
+#include "rasterizer.h"
+
+static const int size = 800;
+
+// Front faces mapped as main.cpp's world2screen() does; the float path gets whole pixels
+static std::vector<Vec3f> screenTriangles(Model &model, bool subpixel)
+{
+    const Vec3f viewDir(0, 0, -1);
+    std::vector<Vec3f> tris;
+    for (int i = 0; i < model.nfaces(); i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        Vec3f v[3];
+        for (int j = 0; j < 3; j++)
+        {
+            Vec3f p = model.vert(face[j]);
+            v[j] = subpixel ? Vec3f((p.x + 1.f) * size / 2.f, (p.y + 1.f) * size / 2.f, p.z)
+                            : Vec3f(int((p.x + 1.f) * size / 2.f + 0.5f), int((p.y + 1.f) * size / 2.f + 0.5f), p.z);
+        }
+        if (((v[2] - v[0]) ^ (v[1] - v[0])) * viewDir <= 0)
+            continue;
+        tris.insert(tris.end(), v, v + 3);
+    }
+    return tris;
+}
+
+static bool sameDepth(const RenderTarget &a, const RenderTarget &b)
+{
+    return memcmp(a.depth_row(0), b.depth_row(0), a.depth_bytes()) == 0;
+}
+
+int main()
+{
+    const char *models[] = {"assets/models/african_head.obj", "assets/models/diablo3_pose.obj", "assets/models/body.obj"};
+    const RenderTarget::DepthFormat formats[] = {RenderTarget::DEPTH_F32, RenderTarget::DEPTH_U24, RenderTarget::DEPTH_U16};
+    int failures = 0;
+    for (const char *path : models)
+    {
+        Model model(path);
+        if (model.nfaces() == 0)
+            return 1;
+        for (bool subpixel : {false, true})
+        {
+            std::vector<Vec3f> tris = screenTriangles(model, subpixel);
+            for (RenderTarget::DepthFormat format : formats)
+            {
+                RasterConfig config;
+                if (subpixel)
+                    config.mode = RasterConfig::FIXED;
+                setRasterConfig(config);
+                RenderTarget color(size, size, RenderTarget::LINEAR, 1, RenderTarget::COLOR_DEPTH, format);
+                RenderTarget depthOnly(size, size, RenderTarget::LINEAR, 1, RenderTarget::DEPTH_ONLY, format);
+                RenderTarget prepassed(size, size, RenderTarget::LINEAR, 1, RenderTarget::COLOR_DEPTH, format);
+                color.clear();
+                depthOnly.clear();
+                prepassed.clear();
+                for (size_t k = 0; k < tris.size(); k += 3)
+                {
+                    rasterize(tris[k], tris[k + 1], tris[k + 2], color, [](const Vec3f &) { return 0xffffffffu; });
+                    rasterizeDepth(tris[k], tris[k + 1], tris[k + 2], depthOnly);
+                    rasterizeDepth(tris[k], tris[k + 1], tris[k + 2], prepassed);
+                }
+                if (!sameDepth(color, depthOnly))
+                {
+                    std::cerr << path << (subpixel ? ", fixed" : ", float") << ", depth format " << format
+                              << ": the depth-only pass wrote different depth from the color pass\n";
+                    failures++;
+                }
+
+                // A GREATER_EQUAL color pass over the prepass must find the depth of every
+                // fragment it would have kept, so it covers the same pixels
+                config.depthTest = RasterConfig::GREATER_EQUAL;
+                setRasterConfig(config);
+                for (size_t k = 0; k < tris.size(); k += 3)
+                    rasterize(tris[k], tris[k + 1], tris[k + 2], prepassed, [](const Vec3f &) { return 0xffffffffu; });
+                int missing = 0;
+                for (int y = 0; y < size; y++)
+                    for (int x = 0; x < size; x++)
+                        missing += color.color_row(y)[x] != prepassed.color_row(y)[x];
+                if (missing > 0)
+                {
+                    std::cerr << path << (subpixel ? ", fixed" : ", float") << ", depth format " << format << ": "
+                              << missing << " pixels left unshaded after the prepass\n";
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
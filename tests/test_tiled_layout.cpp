@@ -0,0 +1,83 @@
+// test_tiled_layout.cpp
+// TILED targets against LINEAR ones: same colors and depths for every coverage mode and depth format
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "model.h"
+#include "rendertarget.h"
+#include "rasterizer.h"
+
+// Not a multiple of the tile size either way, so the last tiles are partly outside the target
+static const int width = 437, height = 301;
+
+static void draw(Model &model, RenderTarget &target)
+{
+    const Vec3f viewDir(0, 0, -1);
+    target.set_depth_range(-1.f, 1.f);
+    target.clear();
+    for (int i = 0; i < model.nfaces(); i++)
+    {
+        const std::vector<int> &face = model.face(i);
+        Vec3f v[3];
+        for (int j = 0; j < 3; j++)
+        {
+            Vec3f p = model.vert(face[j]);
+            v[j] = Vec3f((p.x + 1.f) * width / 2.f, (p.y + 1.f) * height / 2.f, p.z);
+        }
+        if (((v[2] - v[0]) ^ (v[1] - v[0])) * viewDir <= 0)
+            continue;
+        // Face and position in the color, so a pixel written to the wrong place shows up
+        rasterize(v[0], v[1], v[2], target, [i](const Vec3f &bc, int x, int y)
+        {
+            return (uint32_t)(i * 2654435761u) ^ (uint32_t)(bc.x * 255) ^ (uint32_t)(x << 8) ^ (uint32_t)(y << 20);
+        });
+    }
+}
+
+int main()
+{
+    const char *models[] = {"assets/models/african_head.obj", "assets/models/diablo3_pose.obj", "assets/models/body.obj"};
+    const RenderTarget::DepthFormat formats[] = {RenderTarget::DEPTH_F32, RenderTarget::DEPTH_U24, RenderTarget::DEPTH_U16};
+    int failures = 0;
+    for (const char *path : models)
+    {
+        Model model(path);
+        if (model.nfaces() == 0)
+            return 1;
+        for (int mode = 0; mode < 3; mode++)
+        {
+            RasterConfig config;
+            config.mode = mode == 0 ? RasterConfig::FLOAT : RasterConfig::FIXED;
+            setRasterConfig(config);
+            int samples = mode == 2 ? 4 : 1;
+            for (RenderTarget::DepthFormat format : formats)
+            {
+                RenderTarget linear(width, height, RenderTarget::LINEAR, samples, RenderTarget::COLOR_DEPTH, format);
+                RenderTarget tiled(width, height, RenderTarget::TILED, samples, RenderTarget::COLOR_DEPTH, format);
+                draw(model, linear);
+                draw(model, tiled);
+
+                std::vector<uint32_t> ctmp(width), ctmpTiled(width);
+                std::vector<float> ztmp(width), ztmpTiled(width);
+                int differing = 0;
+                for (int y = 0; y < height; y++)
+                {
+                    const uint32_t *c = linear.resolve_colors(y, ctmp.data());
+                    const uint32_t *ct = tiled.resolve_colors(y, ctmpTiled.data());
+                    const float *z = linear.resolve_depths(y, ztmp.data());
+                    const float *zt = tiled.resolve_depths(y, ztmpTiled.data());
+                    for (int x = 0; x < width; x++)
+                        differing += c[x] != ct[x] || memcmp(&z[x], &zt[x], sizeof(float)) != 0;
+                }
+                if (differing > 0)
+                {
+                    std::cerr << path << ", mode " << mode << ", depth format " << format << ": " << differing
+                              << " pixels differ between LINEAR and TILED\n";
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}